@@ -0,0 +1,189 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+Arena_Block *arena_new_block(Arena *arena, size_t size)
+{
+    Arena_Block *block = new Arena_Block;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->data = new char[size];
+    BOLT_STAT_ADD(BOLT_STAT_ALLOCATIONS, 1);
+    arena->reserved += size;
+    return block;
+}
+
+Arena *arena_create(size_t block_size)
+{
+    Arena *arena = new Arena;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->block_size = block_size;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->reserved = 0;
+    arena->allocation_count = 0;
+    return arena;
+}
+
+void arena_destroy(Arena *arena)
+{
+    Arena_Block *block = arena->first;
+    while (block != NULL) {
+        Arena_Block *next = block->next;
+        delete[] block->data;
+        delete block;
+        block = next;
+    }
+    delete arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size_t aligned_size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    Arena_Block *block = arena->current;
+    if (block == NULL) {
+        block = arena->first = arena->current = arena_new_block(arena, aligned_size > arena->block_size ? aligned_size : arena->block_size);
+    }
+    else if (block->size - block->used < aligned_size) {
+        // Move on to the next retained block if it is big enough, otherwise splice in a new one
+        Arena_Block *next = block->next;
+        if (next != NULL and next->size >= aligned_size) {
+            next->used = 0;
+        }
+        else {
+            Arena_Block *inserted = arena_new_block(arena, aligned_size > arena->block_size ? aligned_size : arena->block_size);
+            inserted->next = next;
+            next = inserted;
+        }
+        block->next = next;
+        block = arena->current = next;
+    }
+    void *value = block->data + block->used;
+    block->used += aligned_size;
+    arena->used += aligned_size;
+    arena->allocation_count += 1;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return value;
+}
+
+char *arena_copy_text(Arena *arena, const char *text, size_t size)
+{
+    char *value = (char *) arena_alloc(arena, size + 1);
+    memcpy(value, text, size);
+    value[size] = '\0';
+    return value;
+}
+
+void arena_reset(Arena *arena)
+{
+    // Later blocks are cleared lazily as arena_alloc moves on to them
+    arena->current = arena->first;
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+    arena->used = 0;
+    arena->allocation_count = 0;
+}
+
+Pool *pool_create()
+{
+    Pool *pool = new Pool;
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        pool->free_lists[i] = NULL;
+    }
+    pool->in_use = 0;
+    pool->high_water = 0;
+    return pool;
+}
+
+void pool_destroy(Pool *pool)
+{
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        char *entry = (char *) pool->free_lists[i];
+        while (entry != NULL) {
+            char *next;
+            memcpy(&next, entry + sizeof(size_t), sizeof next);
+            delete[] entry;
+            entry = next;
+        }
+    }
+    delete pool;
+}
+
+int pool_class(size_t size)
+{
+    if (size <= POOL_MIN_CLASS_SIZE) {
+        return 0;
+    }
+    return 64 - __builtin_clzll((unsigned long long) (size - 1)) - 4;
+}
+
+// Each value is preceded by its capacity so that pool_free can find its class
+void *pool_alloc(Pool *pool, size_t size)
+{
+    int size_class = pool_class(size);
+    size_t capacity = size_class < POOL_CLASS_COUNT ? POOL_MIN_CLASS_SIZE << size_class : size;
+    char *entry;
+    if (size_class < POOL_CLASS_COUNT and pool->free_lists[size_class] != NULL) {
+        entry = (char *) pool->free_lists[size_class];
+        memcpy(&pool->free_lists[size_class], entry + sizeof(size_t), sizeof(void *));
+    }
+    else {
+        entry = new char[sizeof(size_t) + capacity];
+        BOLT_STAT_ADD(BOLT_STAT_ALLOCATIONS, 1);
+        memcpy(entry, &capacity, sizeof(size_t));
+    }
+    pool->in_use += capacity;
+    if (pool->in_use > pool->high_water) {
+        pool->high_water = pool->in_use;
+    }
+    return entry + sizeof(size_t);
+}
+
+char *pool_copy_text(Pool *pool, const char *text, size_t size)
+{
+    char *value = (char *) pool_alloc(pool, size + 1);
+    memcpy(value, text, size);
+    value[size] = '\0';
+    return value;
+}
+
+void pool_free(Pool *pool, void *value)
+{
+    if (value == NULL) {
+        return;
+    }
+    char *entry = (char *) value - sizeof(size_t);
+    size_t capacity;
+    memcpy(&capacity, entry, sizeof capacity);
+    pool->in_use -= capacity;
+    int size_class = pool_class(capacity);
+    if (size_class < POOL_CLASS_COUNT) {
+        memcpy(value, &pool->free_lists[size_class], sizeof(void *));
+        pool->free_lists[size_class] = entry;
+    }
+    else {
+        delete[] entry;
+    }
+}
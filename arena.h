@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+
+#ifndef NEO4J_C_DRIVER_ARENA_H
+#define NEO4J_C_DRIVER_ARENA_H
+
+static const size_t ARENA_DEFAULT_BLOCK_SIZE = 65536;
+static const size_t ARENA_ALIGNMENT = 8;
+
+static const size_t POOL_MIN_CLASS_SIZE = 16;
+static const int POOL_CLASS_COUNT = 9;  // 16 bytes to 4 KiB; larger values go straight to the heap
+
+struct Arena_Block
+{
+    Arena_Block *next;
+    size_t size;
+    size_t used;
+    char *data;
+};
+
+// Bump allocator for decoded values that live no longer than a message or result.
+// Blocks are kept across resets so that a steady stream of messages allocates nothing.
+struct Arena
+{
+    Arena_Block *first;
+    Arena_Block *current;
+    size_t block_size;
+
+    size_t used;                // bytes handed out since the last reset
+    size_t high_water;          // largest value of `used` seen so far
+    size_t reserved;            // bytes held in blocks
+    size_t allocation_count;    // allocations since the last reset
+};
+
+// Size-classed free lists for values that must outlive the arena they were decoded from.
+struct Pool
+{
+    void *free_lists[POOL_CLASS_COUNT];
+
+    size_t in_use;              // bytes currently handed out
+    size_t high_water;          // largest value of `in_use` seen so far
+};
+
+Arena *arena_create(size_t block_size);
+
+void arena_destroy(Arena *arena);
+
+void *arena_alloc(Arena *arena, size_t size);
+
+char *arena_copy_text(Arena *arena, const char *text, size_t size);
+
+void arena_reset(Arena *arena);
+
+
+Pool *pool_create();
+
+void pool_destroy(Pool *pool);
+
+void *pool_alloc(Pool *pool, size_t size);
+
+char *pool_copy_text(Pool *pool, const char *text, size_t size);
+
+void pool_free(Pool *pool, void *value);
+
+
+#endif // NEO4J_C_DRIVER_ARENA_H
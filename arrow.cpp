@@ -0,0 +1,349 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "arrow.h"
+
+// FlatBuffers and Arrow are both little-endian
+static const size_t ARROW_ALIGNMENT = 8;
+static const uint32_t ARROW_CONTINUATION = 0xFFFFFFFF;
+static const int16_t ARROW_METADATA_V5 = 4;
+static const uint8_t ARROW_HEADER_SCHEMA = 1;
+static const uint8_t ARROW_HEADER_RECORD_BATCH = 3;
+static const uint8_t ARROW_TYPE_NULL = 1;
+static const uint8_t ARROW_TYPE_INT = 2;
+static const uint8_t ARROW_TYPE_FLOATING_POINT = 3;
+static const uint8_t ARROW_TYPE_UTF8 = 5;
+static const int16_t ARROW_PRECISION_DOUBLE = 2;
+
+// A table field: absent if size is zero, otherwise a little-endian scalar or, for offsets to
+// objects written later, a 4-byte placeholder to patch. `position` is filled in when written.
+struct Flat_Field
+{
+    size_t size;
+    uint64_t value;
+    size_t position;
+};
+
+static const size_t FLAT_INITIAL_CAPACITY = 1024;
+
+void flat_reserve(Flat_Builder *builder, size_t size)
+{
+    if (builder->size + size <= builder->capacity) {
+        return;
+    }
+    size_t capacity = builder->capacity * 2;
+    while (capacity < builder->size + size) {
+        capacity *= 2;
+    }
+    char *data = new char[capacity];
+    memcpy(data, builder->data, builder->size);
+    delete[] builder->data;
+    builder->data = data;
+    builder->capacity = capacity;
+}
+
+void flat_put(Flat_Builder *builder, size_t position, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        builder->data[position + i] = (char) (value >> (8 * i));
+    }
+}
+
+size_t flat_append(Flat_Builder *builder, uint64_t value, size_t size)
+{
+    flat_reserve(builder, size);
+    size_t position = builder->size;
+    flat_put(builder, position, value, size);
+    builder->size += size;
+    return position;
+}
+
+size_t flat_pad(Flat_Builder *builder, size_t alignment)
+{
+    while (builder->size % alignment != 0) {
+        flat_append(builder, 0, 1);
+    }
+    return builder->size;
+}
+
+// Point the offset at `position` forward to the object at `target`
+void flat_patch(Flat_Builder *builder, size_t position, size_t target)
+{
+    flat_put(builder, position, target - position, 4);
+}
+
+// The builder writes front to back, so every object comes after whatever refers to it: a table's
+// vtable is written first, then its fields, largest first so that each is naturally aligned.
+size_t flat_table(Flat_Builder *builder, Flat_Field *fields, int count)
+{
+    flat_pad(builder, 2);
+    size_t vtable = builder->size;
+    size_t vtable_size = 4 + 2 * (size_t) count;
+    for (size_t i = 0; i < vtable_size; i++) {
+        flat_append(builder, 0, 1);
+    }
+    size_t table = flat_pad(builder, ARROW_ALIGNMENT);
+    flat_append(builder, table - vtable, 4);
+    for (size_t width = 8; width >= 1; width /= 2) {
+        for (int i = 0; i < count; i++) {
+            if (fields[i].size != width) {
+                continue;
+            }
+            fields[i].position = flat_pad(builder, width);
+            flat_append(builder, fields[i].value, width);
+            flat_put(builder, vtable + 4 + 2 * i, fields[i].position - table, 2);
+        }
+    }
+    flat_put(builder, vtable, vtable_size, 2);
+    flat_put(builder, vtable + 2, builder->size - table, 2);
+    return table;
+}
+
+// Returns the position of the first of `count` zeroed elements; the vector itself, to which
+// offsets should point, starts at its length just before them
+size_t flat_vector(Flat_Builder *builder, size_t count, size_t element_size, size_t alignment, size_t *vector)
+{
+    if (alignment < 4) {
+        alignment = 4;
+    }
+    while ((builder->size + 4) % alignment != 0) {
+        flat_append(builder, 0, 1);
+    }
+    *vector = flat_append(builder, count, 4);
+    size_t elements = builder->size;
+    flat_reserve(builder, count * element_size);
+    memset(builder->data + elements, 0, count * element_size);
+    builder->size += count * element_size;
+    return elements;
+}
+
+size_t flat_string(Flat_Builder *builder, const char *text, size_t size)
+{
+    flat_pad(builder, 4);
+    size_t position = flat_append(builder, size, 4);
+    flat_reserve(builder, size + 1);
+    memcpy(builder->data + builder->size, text, size);
+    builder->data[builder->size + size] = '\0';
+    builder->size += size + 1;
+    return position;
+}
+
+// Start a Message whose header is patched in by the caller; returns the header offset's position
+size_t arrow_start_message(Flat_Builder *builder, uint8_t header_type, int64_t body_length)
+{
+    builder->size = 0;
+    size_t root = flat_append(builder, 0, 4);
+    Flat_Field message[4] = {
+        {2, (uint64_t) ARROW_METADATA_V5, 0},   // version
+        {1, header_type, 0},                    // header_type
+        {4, 0, 0},                              // header
+        {8, (uint64_t) body_length, 0},         // bodyLength
+    };
+    flat_patch(builder, root, flat_table(builder, message, 4));
+    return message[2].position;
+}
+
+// Frame the encoded message: continuation marker, then the metadata size including padding
+void arrow_write_metadata(Arrow_Writer *writer)
+{
+    Flat_Builder *builder = &writer->builder;
+    flat_pad(builder, ARROW_ALIGNMENT);
+    char prefix[8];
+    for (int i = 0; i < 4; i++) {
+        prefix[i] = (char) (ARROW_CONTINUATION >> (8 * i));
+        prefix[4 + i] = (char) (builder->size >> (8 * i));
+    }
+    output_write(writer->output, prefix, sizeof prefix);
+    output_write(writer->output, builder->data, builder->size);
+}
+
+size_t arrow_padded(size_t size)
+{
+    return (size + ARROW_ALIGNMENT - 1) & ~(ARROW_ALIGNMENT - 1);
+}
+
+// Sizes of the buffers of a column, in the order Arrow expects them; returns how many there are
+int arrow_column_buffers(const Bolt_Column *column, size_t row_count, size_t *sizes)
+{
+    sizes[0] = (row_count + 7) / 8;
+    switch (column->type) {
+        case BOLT_COLUMN_INTEGER:
+        case BOLT_COLUMN_FLOAT:
+            sizes[1] = row_count * 8;
+            return 2;
+        case BOLT_COLUMN_TEXT:
+            sizes[1] = (row_count + 1) * sizeof(int32_t);
+            sizes[2] = column->data_size;
+            return 3;
+        default:
+            // The Null type has no buffers at all
+            return 0;
+    }
+}
+
+const char *arrow_column_buffer(const Bolt_Column *column, int index)
+{
+    if (index == 0) {
+        return (const char *) column->validity;
+    }
+    switch (column->type) {
+        case BOLT_COLUMN_INTEGER:
+            return (const char *) column->integers;
+        case BOLT_COLUMN_FLOAT:
+            return (const char *) column->floats;
+        default:
+            return index == 1 ? (const char *) column->offsets : column->data;
+    }
+}
+
+Arrow_Writer *arrow_writer_open(Output *output)
+{
+    Arrow_Writer *writer = new Arrow_Writer;
+    writer->output = output;
+    writer->builder.data = new char[FLAT_INITIAL_CAPACITY];
+    writer->builder.size = 0;
+    writer->builder.capacity = FLAT_INITIAL_CAPACITY;
+    writer->batch_count = 0;
+    return writer;
+}
+
+void arrow_writer_close(Arrow_Writer *writer)
+{
+    static const char END_OF_STREAM[8] = {(char) 0xFF, (char) 0xFF, (char) 0xFF, (char) 0xFF, 0, 0, 0, 0};
+    output_write(writer->output, END_OF_STREAM, sizeof END_OF_STREAM);
+    delete[] writer->builder.data;
+    delete writer;
+}
+
+void arrow_write_schema(Arrow_Writer *writer, const Bolt_Columns *columns)
+{
+    Flat_Builder *builder = &writer->builder;
+    size_t header = arrow_start_message(builder, ARROW_HEADER_SCHEMA, 0);
+
+    Flat_Field schema[2] = {
+        {2, 0, 0},                              // endianness: little
+        {4, 0, 0},                              // fields
+    };
+    flat_patch(builder, header, flat_table(builder, schema, 2));
+    size_t vector;
+    size_t elements = flat_vector(builder, (size_t) columns->column_count, 4, 4, &vector);
+    flat_patch(builder, schema[1].position, vector);
+
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        const Bolt_Column *column = &columns->columns[c];
+        uint8_t type_type = column->type == BOLT_COLUMN_INTEGER ? ARROW_TYPE_INT :
+                            column->type == BOLT_COLUMN_FLOAT ? ARROW_TYPE_FLOATING_POINT :
+                            column->type == BOLT_COLUMN_TEXT ? ARROW_TYPE_UTF8 : ARROW_TYPE_NULL;
+        Flat_Field field[6] = {
+            {4, 0, 0},                          // name
+            {1, 1, 0},                          // nullable
+            {1, type_type, 0},                  // type_type
+            {4, 0, 0},                          // type
+            {0, 0, 0},                          // dictionary
+            {4, 0, 0},                          // children, which readers expect even when empty
+        };
+        flat_patch(builder, elements + 4 * c, flat_table(builder, field, 6));
+
+        size_t size;
+        const char *name = bolt_columns_name(columns, c, &size);
+        flat_patch(builder, field[0].position, flat_string(builder, name, size));
+
+        size_t type;
+        if (column->type == BOLT_COLUMN_INTEGER) {
+            Flat_Field integer[2] = {
+                {4, 64, 0},                     // bitWidth
+                {1, 1, 0},                      // is_signed
+            };
+            type = flat_table(builder, integer, 2);
+        }
+        else if (column->type == BOLT_COLUMN_FLOAT) {
+            Flat_Field floating_point[1] = {
+                {2, (uint64_t) ARROW_PRECISION_DOUBLE, 0},
+            };
+            type = flat_table(builder, floating_point, 1);
+        }
+        else {
+            // Utf8 and Null tables have no fields
+            type = flat_table(builder, NULL, 0);
+        }
+        flat_patch(builder, field[3].position, type);
+
+        size_t children;
+        flat_vector(builder, 0, 4, 4, &children);
+        flat_patch(builder, field[5].position, children);
+    }
+    arrow_write_metadata(writer);
+}
+
+void arrow_write_batch(Arrow_Writer *writer, const Bolt_Columns *columns)
+{
+    Flat_Builder *builder = &writer->builder;
+    size_t row_count = columns->row_count;
+    size_t sizes[3];
+    size_t buffer_count = 0;
+    size_t body_length = 0;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        int count = arrow_column_buffers(&columns->columns[c], row_count, sizes);
+        for (int i = 0; i < count; i++) {
+            body_length += arrow_padded(sizes[i]);
+        }
+        buffer_count += count;
+    }
+
+    size_t header = arrow_start_message(builder, ARROW_HEADER_RECORD_BATCH, (int64_t) body_length);
+    Flat_Field batch[3] = {
+        {8, row_count, 0},                      // length
+        {4, 0, 0},                              // nodes
+        {4, 0, 0},                              // buffers
+    };
+    flat_patch(builder, header, flat_table(builder, batch, 3));
+
+    // FieldNode and Buffer structs are each a pair of 64-bit integers
+    size_t vector;
+    size_t nodes = flat_vector(builder, (size_t) columns->column_count, 16, 8, &vector);
+    flat_patch(builder, batch[1].position, vector);
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        flat_put(builder, nodes + 16 * c, row_count, 8);
+        flat_put(builder, nodes + 16 * c + 8, columns->columns[c].null_count, 8);
+    }
+    size_t buffers = flat_vector(builder, buffer_count, 16, 8, &vector);
+    flat_patch(builder, batch[2].position, vector);
+    size_t offset = 0;
+    size_t index = 0;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        int count = arrow_column_buffers(&columns->columns[c], row_count, sizes);
+        for (int i = 0; i < count; i++, index++) {
+            flat_put(builder, buffers + 16 * index, offset, 8);
+            flat_put(builder, buffers + 16 * index + 8, sizes[i], 8);
+            offset += arrow_padded(sizes[i]);
+        }
+    }
+    arrow_write_metadata(writer);
+
+    // The body: every buffer, each padded to the alignment
+    static const char PADDING[ARROW_ALIGNMENT] = {0};
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        const Bolt_Column *column = &columns->columns[c];
+        int count = arrow_column_buffers(column, row_count, sizes);
+        for (int i = 0; i < count; i++) {
+            output_write(writer->output, arrow_column_buffer(column, i), sizes[i]);
+            output_write(writer->output, PADDING, arrow_padded(sizes[i]) - sizes[i]);
+        }
+    }
+    writer->batch_count += 1;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_ARROW_H
+#define NEO4J_C_DRIVER_ARROW_H
+
+#include "columns.h"
+#include "output.h"
+
+// Scratch space for encoding FlatBuffers metadata, reused from one message to the next
+struct Flat_Builder
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+// Writes columns as an Apache Arrow IPC stream: a schema message, then one record batch
+// message per call, then an end-of-stream marker. Integer columns become Int64, float
+// columns Float64, text columns Utf8, and columns of unknown type Null.
+struct Arrow_Writer
+{
+    Output *output;
+    Flat_Builder builder;
+    size_t batch_count;
+};
+
+Arrow_Writer *arrow_writer_open(Output *output);
+
+// Write the end-of-stream marker and release the writer (the output itself is left open)
+void arrow_writer_close(Arrow_Writer *writer);
+
+// Fields are named and typed from the columns as they stand; lock their types before the next batch
+void arrow_write_schema(Arrow_Writer *writer, const Bolt_Columns *columns);
+
+void arrow_write_batch(Arrow_Writer *writer, const Bolt_Columns *columns);
+
+
+#endif // NEO4J_C_DRIVER_ARROW_H
@@ -0,0 +1,271 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "async.h"
+
+// Owns a spawned task until it finishes; its frame is freed as soon as it completes
+struct Bolt_Detached
+{
+    struct promise_type
+    {
+        Bolt_Detached get_return_object() { return Bolt_Detached(); }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Each socket is watched one-shot by at most one coroutine at a time, so it is added to
+// the epoll set the first time and re-armed after that
+bool Bolt_Ready::await_suspend(std::coroutine_handle<> awaiting)
+{
+    handle = awaiting;
+    failed = false;
+    struct epoll_event event;
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = this;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, socket, &event) == 0) {
+        return true;
+    }
+    if (errno == ENOENT and epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, socket, &event) == 0) {
+        return true;
+    }
+    failed = true;
+    return false;
+}
+
+Bolt_Loop *bolt_loop_create()
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("Could not create epoll instance");
+        return NULL;
+    }
+    Bolt_Loop *loop = new Bolt_Loop;
+    loop->epoll_fd = epoll_fd;
+    loop->tasks = 0;
+    return loop;
+}
+
+void bolt_loop_destroy(Bolt_Loop *loop)
+{
+    close(loop->epoll_fd);
+    delete loop;
+}
+
+Bolt_Detached bolt_loop_detach(Bolt_Loop *loop, Bolt_Task<void> task)
+{
+    co_await task;
+    loop->tasks -= 1;
+}
+
+void bolt_loop_spawn(Bolt_Loop *loop, Bolt_Task<void> task)
+{
+    loop->tasks += 1;
+    bolt_loop_detach(loop, static_cast<Bolt_Task<void> &&>(task));
+}
+
+bool bolt_loop_run(Bolt_Loop *loop)
+{
+    struct epoll_event events[64];
+    while (loop->tasks > 0) {
+        int count = epoll_wait(loop->epoll_fd, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        for (int i = 0; i < count; i++) {
+            ((Bolt_Ready *) events[i].data.ptr)->handle.resume();
+        }
+    }
+    return true;
+}
+
+Bolt_Task<bool> bolt_async_send(Bolt_Loop *loop, Bolt *bolt)
+{
+    for (;;) {
+        if (!bolt_flush(bolt)) {
+            co_return false;
+        }
+        if (!bolt_sending(bolt)) {
+            co_return true;
+        }
+        bool ready = co_await Bolt_Ready{loop, bolt->socket, EPOLLOUT};
+        if (!ready) {
+            bolt->defunct = true;
+            co_return false;
+        }
+    }
+}
+
+// Wait for more bytes, producing false if the connection has failed
+Bolt_Task<bool> bolt_async_fill(Bolt_Loop *loop, Bolt *bolt)
+{
+    for (;;) {
+        ssize_t received = bolt_fill(bolt);
+        if (received > 0) {
+            co_return true;
+        }
+        if (received == 0 or (errno != EAGAIN and errno != EWOULDBLOCK)) {
+            bolt->defunct = true;
+            co_return false;
+        }
+        bool ready = co_await Bolt_Ready{loop, bolt->socket, EPOLLIN};
+        if (!ready) {
+            bolt->defunct = true;
+            co_return false;
+        }
+    }
+}
+
+Bolt_Task<bool> bolt_async_recv(Bolt_Loop *loop, Bolt *bolt)
+{
+    for (;;) {
+        int parsed = bolt_parse(bolt);
+        if (parsed != 0) {
+            co_return parsed > 0;
+        }
+        bool filled = co_await bolt_async_fill(loop, bolt);
+        if (!filled) {
+            co_return false;
+        }
+    }
+}
+
+Bolt_Task<Bolt *> bolt_async_connect(Bolt_Loop *loop, const char *host, in_port_t port)
+{
+    int client = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (client == -1) {
+        perror("Could not create socket");
+        co_return NULL;
+    }
+    Bolt *bolt = bolt_create(client);
+
+    struct sockaddr_in server;
+    server.sin_addr.s_addr = inet_addr(host);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+
+    if (connect(client, (struct sockaddr *) &server, sizeof(server)) < 0) {
+        int error = errno;
+        if (error == EINPROGRESS) {
+            socklen_t size = sizeof(error);
+            bool ready = co_await Bolt_Ready{loop, client, EPOLLOUT};
+            if (!ready or getsockopt(client, SOL_SOCKET, SO_ERROR, &error, &size) < 0) {
+                error = errno;
+            }
+        }
+        if (error != 0) {
+            errno = error;
+            perror("connect failed. Error");
+            bolt_disconnect(bolt);
+            co_return NULL;
+        }
+    }
+
+    bolt_handshake(bolt);
+    bool connected = co_await bolt_async_send(loop, bolt);
+    while (connected and !bolt_read_version(bolt)) {
+        connected = co_await bolt_async_fill(loop, bolt);
+    }
+    if (!connected or bolt->version == 0) {
+        bolt_disconnect(bolt);
+        co_return NULL;
+    }
+    co_return bolt;
+}
+
+Bolt_Task<bool> bolt_async_init(Bolt_Loop *loop, Bolt *bolt, const char *user_agent)
+{
+    bolt_init(bolt, user_agent);
+    bool sent = co_await bolt_async_send(loop, bolt);
+    if (!sent) {
+        co_return false;
+    }
+    bool received = co_await bolt_async_recv(loop, bolt);
+    co_return received and bolt->message_signature == SUCCESS_MESSAGE;
+}
+
+Bolt_Task<Bolt_Cursor *> bolt_async_run(Bolt_Loop *loop, Bolt *bolt, const char *statement, size_t parameter_count,
+                                        PackStream_Pair *parameters)
+{
+    bolt_run(bolt, statement, parameter_count, parameters);
+    bolt_pull_all(bolt);
+    Bolt_Cursor *cursor = bolt_cursor_create(bolt);
+    bool received = co_await bolt_async_send(loop, bolt);
+    // Acknowledgements of earlier failures may still be ahead of this result
+    while (received and bolt_next_request(bolt) == ACK_FAILURE_MESSAGE) {
+        received = co_await bolt_async_recv(loop, bolt);
+    }
+    if (received) {
+        received = co_await bolt_async_recv(loop, bolt);
+    }
+    if (!received) {
+        bolt_cursor_fail(cursor, "Connection failed");
+        co_return cursor;
+    }
+    if (bolt_cursor_accept_header(cursor)) {
+        // After a failed RUN, PULL_ALL will have been ignored
+        received = co_await bolt_async_recv(loop, bolt);
+        if (!received) {
+            cursor->failure_pending = false;
+        }
+    }
+    co_return cursor;
+}
+
+Bolt_Task<bool> bolt_async_fetch(Bolt_Loop *loop, Bolt_Cursor *cursor)
+{
+    if (cursor->state != BOLT_CURSOR_STREAMING) {
+        co_return false;
+    }
+    bool received = co_await bolt_async_recv(loop, cursor->bolt);
+    if (!received) {
+        bolt_cursor_fail(cursor, "Connection failed");
+        co_return false;
+    }
+    co_return bolt_cursor_accept(cursor);
+}
+
+Bolt_Task<void> bolt_async_close(Bolt_Loop *loop, Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    bool fetched = true;
+    while (fetched) {
+        fetched = co_await bolt_async_fetch(loop, cursor);
+    }
+    bool received = true;
+    if (bolt_cursor_acknowledge(cursor)) {
+        received = co_await bolt_async_send(loop, bolt);
+    }
+    while (received and bolt->in_flight_count > 0 and bolt->in_flight_count == bolt->acks_in_flight) {
+        received = co_await bolt_async_recv(loop, bolt);
+    }
+    bolt_cursor_destroy(cursor);
+}
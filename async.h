@@ -0,0 +1,180 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_ASYNC_H
+#define NEO4J_C_DRIVER_ASYNC_H
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+
+#include "bolt.h"
+#include "cursor.h"
+
+// A lazily started coroutine producing a T. Awaiting it starts it and resumes the awaiting
+// coroutine directly when it finishes, so a chain of awaits costs no trips through the loop.
+template <typename T>
+struct Bolt_Task;
+
+template <typename T>
+struct Bolt_Task_Promise_Base
+{
+    std::coroutine_handle<> continuation;
+
+    struct Final_Awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    Final_Awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+struct Bolt_Task_Promise : Bolt_Task_Promise_Base<T>
+{
+    T value;
+
+    Bolt_Task<T> get_return_object();
+
+    void return_value(T result) { value = result; }
+};
+
+template <>
+struct Bolt_Task_Promise<void> : Bolt_Task_Promise_Base<void>
+{
+    Bolt_Task<void> get_return_object();
+
+    void return_void() {}
+};
+
+template <typename T>
+struct Bolt_Task
+{
+    typedef Bolt_Task_Promise<T> promise_type;
+
+    std::coroutine_handle<promise_type> coroutine;
+
+    explicit Bolt_Task(std::coroutine_handle<promise_type> handle) : coroutine(handle) {}
+
+    Bolt_Task(Bolt_Task &&other) noexcept : coroutine(other.coroutine) { other.coroutine = nullptr; }
+
+    Bolt_Task(const Bolt_Task &) = delete;
+
+    ~Bolt_Task()
+    {
+        if (coroutine) {
+            coroutine.destroy();
+        }
+    }
+
+    bool await_ready() { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+    {
+        coroutine.promise().continuation = awaiting;
+        return coroutine;
+    }
+
+    T await_resume()
+    {
+        if constexpr (!std::is_void<T>::value) {
+            return coroutine.promise().value;
+        }
+    }
+};
+
+template <typename T>
+Bolt_Task<T> Bolt_Task_Promise<T>::get_return_object()
+{
+    return Bolt_Task<T>(std::coroutine_handle<Bolt_Task_Promise<T>>::from_promise(*this));
+}
+
+inline Bolt_Task<void> Bolt_Task_Promise<void>::get_return_object()
+{
+    return Bolt_Task<void>(std::coroutine_handle<Bolt_Task_Promise<void>>::from_promise(*this));
+}
+
+// An epoll loop that resumes coroutines when their sockets are ready. A loop belongs to one
+// thread; to spread connections over several cores, run one loop on each of a few threads.
+struct Bolt_Loop
+{
+    int epoll_fd;
+    unsigned long tasks;        // spawned tasks that have not yet finished
+};
+
+// Suspends the awaiting coroutine until a socket is ready for the given epoll events
+struct Bolt_Ready
+{
+    Bolt_Loop *loop;
+    int socket;
+    uint32_t events;
+    std::coroutine_handle<> handle{};
+    bool failed = false;
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> awaiting);
+
+    // false if the socket could not be watched
+    bool await_resume() { return !failed; }
+};
+
+Bolt_Loop *bolt_loop_create();
+
+void bolt_loop_destroy(Bolt_Loop *loop);
+
+// Start a task, which runs until its first suspension before this returns; the loop owns it from then on
+void bolt_loop_spawn(Bolt_Loop *loop, Bolt_Task<void> task);
+
+// Resume coroutines as their sockets become ready until every spawned task has finished
+bool bolt_loop_run(Bolt_Loop *loop);
+
+// Connect and perform the handshake, producing NULL on failure. The connection is non-blocking
+// and should only be used through these functions or a Bolt_Engine.
+Bolt_Task<Bolt *> bolt_async_connect(Bolt_Loop *loop, const char *host, in_port_t port);
+
+// Send everything queued by the synchronous message functions
+Bolt_Task<bool> bolt_async_send(Bolt_Loop *loop, Bolt *bolt);
+
+// Receive the next message, as bolt_recv does
+Bolt_Task<bool> bolt_async_recv(Bolt_Loop *loop, Bolt *bolt);
+
+Bolt_Task<bool> bolt_async_init(Bolt_Loop *loop, Bolt *bolt, const char *user_agent);
+
+// Send RUN and PULL_ALL and read the header of the result; use with bolt_async_fetch and
+// bolt_async_close in place of bolt_cursor_fetch and bolt_cursor_close
+Bolt_Task<Bolt_Cursor *> bolt_async_run(Bolt_Loop *loop, Bolt *bolt, const char *statement, size_t parameter_count,
+                                        PackStream_Pair *parameters);
+
+Bolt_Task<bool> bolt_async_fetch(Bolt_Loop *loop, Bolt_Cursor *cursor);
+
+Bolt_Task<void> bolt_async_close(Bolt_Loop *loop, Bolt_Cursor *cursor);
+
+
+#endif // NEO4J_C_DRIVER_ASYNC_H
@@ -14,14 +14,20 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <iostream>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <arpa/inet.h>
 #include <iomanip>
+#include <unistd.h>
 
 #include "packstream.h"
 #include "bolt.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -44,98 +50,583 @@ void dump(const char *buffer, ssize_t size)
 void bolt_reset_writer(Bolt *bolt)
 {
     bolt->writer = bolt->write_buffer;
+    bolt->buffered_run_start = 0;
+    bolt->segment_count = 0;
+    bolt->send_next = 0;
+    bolt->send_skip = 0;
+}
+
+// Make room for at least `size` more bytes at the writer
+void bolt_reserve_write_buffer(Bolt *bolt, size_t size)
+{
+    size_t used = bolt->writer - bolt->write_buffer;
+    if (used + size <= bolt->write_buffer_size) {
+        return;
+    }
+    size_t new_size = bolt->write_buffer_size;
+    while (new_size < used + size) {
+        new_size *= 2;
+    }
+    char *buffer = new char[new_size];
+    BOLT_STAT_ADD(BOLT_STAT_BUFFER_GROWTHS, 1);
+    memcpy(buffer, bolt->write_buffer, used);
+    bolt->start_of_chunk = buffer + (bolt->start_of_chunk - bolt->write_buffer);
+    bolt->writer = buffer + used;
+    delete[] bolt->write_buffer;
+    bolt->write_buffer = buffer;
+    bolt->write_buffer_size = new_size;
+}
+
+void bolt_add_segment(Bolt *bolt, const char *data, size_t offset, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    if (data == NULL and bolt->segment_count > 0) {
+        Bolt_Segment *last = &bolt->segments[bolt->segment_count - 1];
+        if (last->data == NULL and last->offset + last->size == offset) {
+            last->size += size;
+            return;
+        }
+    }
+    if (bolt->segment_count == bolt->segment_capacity) {
+        Bolt_Segment *segments = new Bolt_Segment[bolt->segment_capacity * 2];
+        BOLT_STAT_ADD(BOLT_STAT_BUFFER_GROWTHS, 1);
+        memcpy(segments, bolt->segments, bolt->segment_count * sizeof(Bolt_Segment));
+        delete[] bolt->segments;
+        bolt->segments = segments;
+        bolt->segment_capacity *= 2;
+    }
+    Bolt_Segment *segment = &bolt->segments[bolt->segment_count];
+    segment->data = data;
+    segment->offset = offset;
+    segment->size = size;
+    bolt->segment_count += 1;
+}
+
+// Close off the buffered bytes written so far as a segment
+void bolt_end_buffered_run(Bolt *bolt)
+{
+    size_t offset = bolt->writer - bolt->write_buffer;
+    bolt_add_segment(bolt, NULL, bolt->buffered_run_start, offset - bolt->buffered_run_start);
+    bolt->buffered_run_start = offset;
+}
+
+// Queue caller-owned bytes to be sent in place, without copying them into the write buffer
+void bolt_write_borrowed(Bolt *bolt, const char *data, size_t size)
+{
+    bolt_end_buffered_run(bolt);
+    bolt_add_segment(bolt, data, 0, size);
+    bolt->chunk_borrowed_size += size;
 }
 
 void bolt_start_chunk(Bolt *bolt)
 {
+    bolt_reserve_write_buffer(bolt, 2);
     bolt->start_of_chunk = bolt->writer;
     bolt->writer += 2;
+    bolt->chunk_borrowed_size = 0;
+    bolt->chunk_segment_index = bolt->segment_count;
+}
+
+// Re-frame an oversized chunk as several. The body stays where it was written; new
+// chunk headers are appended to the write buffer and queued between slices of it.
+void bolt_split_chunk(Bolt *bolt, size_t size)
+{
+    size_t header_offset = bolt->start_of_chunk - bolt->write_buffer;
+    bolt_end_buffered_run(bolt);
+    // The run holding the placeholder header may have been merged into an earlier segment, as
+    // when it continues a run left queued by a partial flush, so chunk_segment_index can be
+    // one past the last segment. Walk back to the buffered segment that starts at or before it.
+    if (bolt->chunk_segment_index > bolt->segment_count - 1) {
+        bolt->chunk_segment_index = bolt->segment_count - 1;
+    }
+    while (bolt->segments[bolt->chunk_segment_index].data != NULL or
+           bolt->segments[bolt->chunk_segment_index].offset > header_offset) {
+        bolt->chunk_segment_index -= 1;
+    }
+    int body_count = bolt->segment_count - bolt->chunk_segment_index;
+    Bolt_Segment *body = new Bolt_Segment[body_count];
+    memcpy(body, &bolt->segments[bolt->chunk_segment_index], body_count * sizeof(Bolt_Segment));
+    bolt->segment_count = bolt->chunk_segment_index;
+
+    // The first segment contains the placeholder header, possibly preceded by earlier messages
+    bolt_add_segment(bolt, NULL, body[0].offset, header_offset - body[0].offset);
+    body[0].size -= header_offset + 2 - body[0].offset;
+    body[0].offset = header_offset + 2;
+
+    size_t chunk_count = (size + bolt->max_chunk_size - 1) / bolt->max_chunk_size;
+    BOLT_STAT_ADD(BOLT_STAT_CHUNKS_SENT, chunk_count);
+    bolt_reserve_write_buffer(bolt, 2 * chunk_count);
+    size_t unframed = size;
+    size_t chunk_remaining = 0;
+    for (int i = 0; i < body_count; i++) {
+        Bolt_Segment *segment = &body[i];
+        size_t position = 0;
+        while (position < segment->size) {
+            if (chunk_remaining == 0) {
+                chunk_remaining = unframed < bolt->max_chunk_size ? unframed : bolt->max_chunk_size;
+                unframed -= chunk_remaining;
+                bolt->writer[0] = (char) (chunk_remaining >> 8);
+                bolt->writer[1] = (char) (chunk_remaining & 0xFF);
+                bolt_add_segment(bolt, NULL, bolt->writer - bolt->write_buffer, 2);
+                bolt->writer += 2;
+            }
+            size_t slice = segment->size - position < chunk_remaining ? segment->size - position : chunk_remaining;
+            if (segment->data == NULL) {
+                bolt_add_segment(bolt, NULL, segment->offset + position, slice);
+            }
+            else {
+                bolt_add_segment(bolt, segment->data + position, 0, slice);
+            }
+            position += slice;
+            chunk_remaining -= slice;
+        }
+    }
+    bolt->buffered_run_start = bolt->writer - bolt->write_buffer;
+    delete[] body;
 }
 
 void bolt_end_chunk(Bolt *bolt)
 {
-    size_t chunk_size = bolt->writer - bolt->start_of_chunk - 2;
+    size_t chunk_size = bolt->writer - bolt->start_of_chunk - 2 + bolt->chunk_borrowed_size;
+    if (chunk_size > bolt->max_chunk_size) {
+        bolt_split_chunk(bolt, chunk_size);
+        return;
+    }
     bolt->start_of_chunk[0] = (char) (chunk_size >> 8);
     bolt->start_of_chunk[1] = (char) (chunk_size & 0xFF);
+    BOLT_STAT_ADD(BOLT_STAT_CHUNKS_SENT, 1);
 }
 
 void bolt_end_message(Bolt *bolt)
 {
+    bolt_reserve_write_buffer(bolt, 2);
     bolt->writer[0] = (char) 0x00;
     bolt->writer[1] = (char) 0x00;
     bolt->writer += 2;
+    BOLT_STAT_ADD(BOLT_STAT_MESSAGES_SENT, 1);
 }
 
-ssize_t bolt_send_data(Bolt *bolt, const char *buffer, size_t size)
+// A value that cannot be encoded leaves the message incomplete, so the connection is given up
+void bolt_write_text(Bolt *bolt, size_t size, const char *value)
 {
-    ssize_t sent = send(bolt->socket, buffer, size, 0);
-    //cerr << "C: "; dump(buffer, size);
-    return sent;
+    if (size >= ZERO_COPY_THRESHOLD) {
+        bolt_reserve_write_buffer(bolt, 5);
+        if (!packstream_write_text_header(&bolt->writer, size)) {
+            bolt->defunct = true;
+            return;
+        }
+        bolt_write_borrowed(bolt, value, size);
+    }
+    else {
+        bolt_reserve_write_buffer(bolt, 5 + size);
+        packstream_write_text(&bolt->writer, size, value);
+    }
+}
+
+void bolt_write_bytes(Bolt *bolt, size_t size, const char *value)
+{
+    if (size >= ZERO_COPY_THRESHOLD) {
+        bolt_reserve_write_buffer(bolt, 5);
+        if (!packstream_write_bytes_header(&bolt->writer, size)) {
+            bolt->defunct = true;
+            return;
+        }
+        bolt_write_borrowed(bolt, value, size);
+    }
+    else {
+        bolt_reserve_write_buffer(bolt, 5 + size);
+        packstream_write_bytes(&bolt->writer, size, value);
+    }
+}
+
+void bolt_write_value(Bolt *bolt, PackStream_Value *value)
+{
+    switch (value->type) {
+        case PACKSTREAM_TEXT:
+            bolt_write_text(bolt, value->size, (char *) (value->value));
+            break;
+        case PACKSTREAM_BYTES:
+            bolt_write_bytes(bolt, value->size, (char *) (value->value));
+            break;
+        default:
+            bolt_reserve_write_buffer(bolt, 9);
+            if (!packstream_write_value(&bolt->writer, value)) {
+                bolt->defunct = true;
+            }
+    }
+}
+
+void bolt_write_map(Bolt *bolt, size_t size, PackStream_Pair *entries)
+{
+    bolt_reserve_write_buffer(bolt, 5);
+    if (!packstream_write_map_header(&bolt->writer, size)) {
+        bolt->defunct = true;
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        bolt_write_value(bolt, &entries[i].name);
+        bolt_write_value(bolt, &entries[i].value);
+    }
+}
+
+// Send the queued segments with as few sendmsg calls as possible, resuming after partial
+// writes. A non-blocking socket that fills up ends the call early, with send_next and
+// send_skip marking where the next call picks up. Returns false if the connection failed.
+bool bolt_send_segments(Bolt *bolt)
+{
+    struct iovec iov[IOV_MAX];
+    while (bolt->send_next < bolt->segment_count) {
+        int count = 0;
+        for (int i = bolt->send_next; i < bolt->segment_count and count < IOV_MAX; i++, count++) {
+            Bolt_Segment *segment = &bolt->segments[i];
+            const char *data = segment->data == NULL ? bolt->write_buffer + segment->offset : segment->data;
+            size_t offset = i == bolt->send_next ? bolt->send_skip : 0;
+            iov[count].iov_base = (void *) (data + offset);
+            iov[count].iov_len = segment->size - offset;
+        }
+        struct msghdr message;
+        memset(&message, 0, sizeof message);
+        message.msg_iov = iov;
+        message.msg_iovlen = (size_t) count;
+        ssize_t sent = sendmsg(bolt->socket, &message, MSG_NOSIGNAL);
+        BOLT_STAT_ADD(BOLT_STAT_SEND_CALLS, 1);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN or errno == EWOULDBLOCK;
+        }
+        BOLT_STAT_ADD(BOLT_STAT_SEND_BYTES, (uint64_t) sent);
+        size_t remaining = (size_t) sent + bolt->send_skip;
+        while (bolt->send_next < bolt->segment_count and remaining >= bolt->segments[bolt->send_next].size) {
+            remaining -= bolt->segments[bolt->send_next].size;
+            bolt->send_next += 1;
+        }
+        bolt->send_skip = remaining;
+    }
+    return true;
+}
+
+bool bolt_sending(Bolt *bolt)
+{
+    return bolt->send_next < bolt->segment_count;
+}
+
+bool bolt_flush(Bolt *bolt)
+{
+    // Nothing is sent once a message could not be encoded
+    if (bolt->defunct) {
+        return false;
+    }
+    bolt_end_buffered_run(bolt);
+    if (!bolt_send_segments(bolt)) {
+        bolt->defunct = true;
+        return false;
+    }
+    if (!bolt_sending(bolt)) {
+        bolt_reset_writer(bolt);
+    }
+    return true;
 }
 
 // Send all queued messages
 ssize_t bolt_send(Bolt *bolt)
 {
-    ssize_t size = bolt_send_data(bolt, bolt->write_buffer, bolt->writer - bolt->write_buffer);
-    bolt_reset_writer(bolt);
-    return size;
+    bolt_end_buffered_run(bolt);
+    size_t size = 0;
+    for (int i = bolt->send_next; i < bolt->segment_count; i++) {
+        size += bolt->segments[i].size;
+    }
+    size -= bolt->send_skip;
+    if (!bolt_flush(bolt)) {
+        return -1;
+    }
+    return (ssize_t) size;
+}
+
+ssize_t bolt_recv_some(Bolt *bolt, char *buffer, size_t size)
+{
+    ssize_t received;
+    do {
+        received = recv(bolt->socket, buffer, size, 0);
+        BOLT_STAT_ADD(BOLT_STAT_RECV_CALLS, 1);
+    } while (received < 0 and errno == EINTR);
+    if (received > 0) {
+        BOLT_STAT_ADD(BOLT_STAT_RECV_BYTES, (uint64_t) received);
+    }
+    return received;
+}
+
+void bolt_resize_read_buffer(Bolt *bolt, size_t size)
+{
+    char *buffer = new char[size];
+    memcpy(buffer, bolt->read_buffer, (size_t) bolt->message_size);
+    delete[] bolt->read_buffer;
+    bolt->read_buffer = buffer;
+    bolt->read_buffer_size = size;
+}
+
+// Grow the read buffer geometrically until it can hold `size` bytes
+bool bolt_reserve_read_buffer(Bolt *bolt, size_t size)
+{
+    if (size <= bolt->read_buffer_size) {
+        return true;
+    }
+    if (size > bolt->max_read_buffer_size) {
+        return false;
+    }
+    size_t new_size = bolt->read_buffer_size;
+    while (new_size < size) {
+        new_size *= 2;
+    }
+    if (new_size > bolt->max_read_buffer_size) {
+        new_size = bolt->max_read_buffer_size;
+    }
+    bolt_resize_read_buffer(bolt, new_size);
+    BOLT_STAT_ADD(BOLT_STAT_BUFFER_GROWTHS, 1);
+    return true;
+}
+
+// Release an oversized read buffer once a run of ordinary messages shows the outlier has passed
+void bolt_shrink_read_buffer(Bolt *bolt)
+{
+    if (bolt->read_buffer_size <= INITIAL_BUFFER_SIZE) {
+        return;
+    }
+    if (bolt->message_size > INITIAL_BUFFER_SIZE) {
+        bolt->small_message_count = 0;
+        return;
+    }
+    bolt->small_message_count += 1;
+    if (bolt->small_message_count >= READ_BUFFER_SHRINK_DELAY) {
+        bolt->message_size = 0;
+        bolt_resize_read_buffer(bolt, INITIAL_BUFFER_SIZE);
+        bolt->small_message_count = 0;
+    }
 }
 
-ssize_t bolt_recv_data(Bolt *bolt, void *buffer, size_t size)
+// Receive more bytes from the socket. While at least DIRECT_RECV_THRESHOLD bytes of a chunk body
+// are outstanding and nothing is buffered, only that body is received, straight into the read
+// buffer (already reserved for the whole chunk); otherwise the bytes are appended to recv_buffer,
+// after moving any partial chunk header to its start. Returns the number of bytes received, 0 if
+// the server closed the connection, or -1 (EAGAIN if non-blocking and idle).
+ssize_t bolt_fill(Bolt *bolt)
 {
-    ssize_t received = recv(bolt->socket, buffer, size, 0);
-    //cerr << "S: "; dump((char *) buffer, size);
+    size_t buffered = (size_t) (bolt->recv_end - bolt->recv_start);
+    if (buffered == 0 and bolt->chunk_remaining >= DIRECT_RECV_THRESHOLD) {
+        ssize_t received = bolt_recv_some(bolt, bolt->read_buffer + bolt->message_size, bolt->chunk_remaining);
+        if (received > 0) {
+            bolt->message_size += received;
+            bolt->chunk_remaining -= received;
+        }
+        return received;
+    }
+    if (bolt->recv_start != bolt->recv_buffer) {
+        memmove(bolt->recv_buffer, bolt->recv_start, buffered);
+        bolt->recv_start = bolt->recv_buffer;
+        bolt->recv_end = bolt->recv_buffer + buffered;
+    }
+    ssize_t received = bolt_recv_some(bolt, bolt->recv_end, RECV_BUFFER_SIZE - buffered);
+    if (received > 0) {
+        bolt->recv_end += received;
+    }
     return received;
 }
 
-uint32_t bolt_recv_uint32(Bolt *bolt)
+// Note that the summary just received answers the oldest request in flight
+void bolt_complete_request(Bolt *bolt)
 {
-    unsigned char buffer[4];
+    bolt->message_request = 0;
+    if (bolt->in_flight_count == 0) {
+        return;
+    }
+    bolt->message_request = bolt->in_flight[bolt->in_flight_head];
+    if (bolt->message_request == ACK_FAILURE_MESSAGE) {
+        bolt->acks_in_flight -= 1;
+    }
+    bolt->in_flight_head = (bolt->in_flight_head + 1) % bolt->in_flight_capacity;
+    bolt->in_flight_count -= 1;
+}
 
-    ssize_t received = bolt_recv_data(bolt, buffer, sizeof(buffer));
-    if (received < 0) {
-        puts("recv failed");
+// Move buffered chunk bodies into the read buffer, returning 1 once a whole message is there
+int bolt_reassemble(Bolt *bolt)
+{
+    if (!bolt->receiving) {
+        // The previous message stays readable until bytes of the next one arrive
+        if (bolt->recv_start == bolt->recv_end) {
+            return 0;
+        }
+        arena_reset(bolt->arena);
+        bolt_shrink_read_buffer(bolt);
+        bolt->message_size = 0;
+        bolt->chunk_remaining = 0;
+        bolt->receiving = true;
     }
+    for (;;) {
+        size_t buffered = (size_t) (bolt->recv_end - bolt->recv_start);
+        if (bolt->chunk_remaining > 0) {
+            if (buffered == 0) {
+                return 0;
+            }
+            size_t taken = bolt->chunk_remaining < buffered ? bolt->chunk_remaining : buffered;
+            memcpy(bolt->read_buffer + bolt->message_size, bolt->recv_start, taken);
+            bolt->recv_start += taken;
+            bolt->message_size += taken;
+            bolt->chunk_remaining -= taken;
+            continue;
+        }
+        if (buffered < 2) {
+            return 0;
+        }
+        const unsigned char *header = (const unsigned char *) bolt->recv_start;
+        size_t chunk_size = (size_t) (header[0] << 8 | header[1]);
+        bolt->recv_start += 2;
+        if (chunk_size == 0) {
+            if (bolt->message_size == 0) {
+                // A lone end marker carries no message
+                continue;
+            }
+            break;
+        }
+        if (!bolt_reserve_read_buffer(bolt, bolt->message_size + chunk_size)) {
+            puts("message exceeds maximum read buffer size");
+            bolt->defunct = true;
+            return -1;
+        }
+        bolt->chunk_remaining = chunk_size;
+        BOLT_STAT_ADD(BOLT_STAT_CHUNKS_RECEIVED, 1);
+    }
+    bolt->receiving = false;
+    BOLT_STAT_ADD(BOLT_STAT_MESSAGES_RECEIVED, 1);
+    return 1;
+}
 
-    uint32_t value = buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
-    return value;
+int bolt_parse(Bolt *bolt)
+{
+    BOLT_STAT_START(start);
+    int reassembled = bolt_reassemble(bolt);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    if (reassembled <= 0) {
+        return reassembled;
+    }
+    // The structure header is timed as decoding by the PackStream reader itself
+    bolt->reader = bolt->read_buffer;
+    if (!packstream_read_structure_header(&bolt->reader, &bolt->message_field_count, &bolt->message_signature)) {
+        bolt->defunct = true;
+        return -1;
+    }
+    if (bolt->message_signature == RECORD_MESSAGE) {
+        bolt->message_request = 0;
+    }
+    else {
+        bolt_complete_request(bolt);
+    }
+    return 1;
 }
 
 // Receive the next message
 bool bolt_recv(Bolt *bolt)
 {
-    char header[2];
-    bolt->message_size = 0;
-    size_t chunk_size;
-    do {
-        ssize_t received = bolt_recv_data(bolt, header, sizeof(header));
-        if (received < 0) {
+    for (;;) {
+        int parsed = bolt_parse(bolt);
+        if (parsed != 0) {
+            return parsed > 0;
+        }
+        if (bolt_fill(bolt) <= 0) {
             puts("recv failed");
+            bolt->defunct = true;
+            return false;
         }
-        chunk_size = (uint16_t) (header[0] << 8 | header[1]);
-        if (chunk_size > 0) {
-            // TODO check for buffer overflow and extend buffer if necessary
-            bolt_recv_data(bolt, bolt->read_buffer + bolt->message_size, chunk_size);
-            bolt->message_size += chunk_size;
+    }
+}
+
+char bolt_next_request(Bolt *bolt)
+{
+    return bolt->in_flight_count == 0 ? 0 : bolt->in_flight[bolt->in_flight_head];
+}
+
+// Note that a response is now due for a request of this type
+void bolt_expect(Bolt *bolt, char signature)
+{
+    if (bolt->in_flight_count == bolt->in_flight_capacity) {
+        char *in_flight = new char[bolt->in_flight_capacity * 2];
+        BOLT_STAT_ADD(BOLT_STAT_BUFFER_GROWTHS, 1);
+        for (int i = 0; i < bolt->in_flight_count; i++) {
+            in_flight[i] = bolt->in_flight[(bolt->in_flight_head + i) % bolt->in_flight_capacity];
         }
-    } while (chunk_size > 0);
-    bolt->reader = bolt->read_buffer;
-    return packstream_read_structure_header(&bolt->reader, &bolt->message_field_count, &bolt->message_signature);
+        delete[] bolt->in_flight;
+        bolt->in_flight = in_flight;
+        bolt->in_flight_head = 0;
+        bolt->in_flight_capacity *= 2;
+    }
+    bolt->in_flight[(bolt->in_flight_head + bolt->in_flight_count) % bolt->in_flight_capacity] = signature;
+    bolt->in_flight_count += 1;
+    if (signature == ACK_FAILURE_MESSAGE) {
+        bolt->acks_in_flight += 1;
+    }
 }
 
-Bolt *bolt_connect(const char *host, const in_port_t port)
+bool bolt_read_key(Bolt *bolt, char **reader, uint32_t *key)
+{
+    int32_t size;
+    const char *text;
+    if (!packstream_read_text_view(reader, &size, &text)) {
+        return false;
+    }
+    *key = intern_id_bounded(bolt->strings, text, (size_t) size, MAX_INTERNED_KEYS, MAX_INTERNED_KEY_SIZE);
+    return true;
+}
+
+Bolt *bolt_create(int socket)
 {
     Bolt *bolt = new Bolt;
+    bolt->socket = socket;
+    bolt->version = 0;
     bolt->read_buffer = new char[INITIAL_BUFFER_SIZE];
+    bolt->read_buffer_size = INITIAL_BUFFER_SIZE;
+    bolt->max_read_buffer_size = DEFAULT_MAX_READ_BUFFER_SIZE;
+    bolt->small_message_count = 0;
+    bolt->message_size = 0;
+    bolt->recv_buffer = new char[RECV_BUFFER_SIZE];
+    bolt->recv_start = bolt->recv_end = bolt->recv_buffer;
     bolt->write_buffer = new char[INITIAL_BUFFER_SIZE];
+    bolt->write_buffer_size = INITIAL_BUFFER_SIZE;
+    bolt->segments = new Bolt_Segment[INITIAL_SEGMENT_CAPACITY];
+    bolt->segment_capacity = INITIAL_SEGMENT_CAPACITY;
+    bolt->in_flight = new char[INITIAL_IN_FLIGHT_CAPACITY];
+    bolt->in_flight_head = 0;
+    bolt->in_flight_count = 0;
+    bolt->in_flight_capacity = INITIAL_IN_FLIGHT_CAPACITY;
+    bolt->acks_in_flight = 0;
+    bolt->max_chunk_size = MAX_CHUNK_SIZE;
+    bolt->defunct = false;
+    bolt->receiving = false;
+    bolt->chunk_remaining = 0;
+    bolt->message_request = 0;
+    bolt->send_next = 0;
+    bolt->send_skip = 0;
+    bolt->arena = arena_create(ARENA_DEFAULT_BLOCK_SIZE);
+    bolt->pool = pool_create();
+    bolt->strings = intern_create();
+    intern_id(bolt->strings, "fields", 6);
+    intern_id(bolt->strings, "code", 4);
+    intern_id(bolt->strings, "message", 7);
 
+    bolt_reset_writer(bolt);
+    return bolt;
+}
+
+Bolt *bolt_connect(const char *host, const in_port_t port)
+{
     // Create socket
-    bolt->socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (bolt->socket == -1) {
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    if (client == -1) {
         perror("Could not create socket");
-        bolt->version = 0;
         return NULL;
     }
+    Bolt *bolt = bolt_create(client);
 
     struct sockaddr_in server;
 
@@ -147,47 +638,149 @@ Bolt *bolt_connect(const char *host, const in_port_t port)
     // Connect to remote server
     if (connect(bolt->socket, (struct sockaddr *) &server, sizeof(server)) < 0) {
         perror("connect failed. Error");
-        bolt->version = 0;
+        bolt_disconnect(bolt);
         return NULL;
     }
 
     // Perform handshake
-    bolt_send_data(bolt, "\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
-    bolt->version = bolt_recv_uint32(bolt);
-
-    bolt_reset_writer(bolt);
+    bolt_handshake(bolt);
+    bolt_send(bolt);
+    while (!bolt_read_version(bolt)) {
+        if (bolt_fill(bolt) <= 0) {
+            puts("recv failed");
+            bolt_disconnect(bolt);
+            return NULL;
+        }
+    }
+    if (bolt->version == 0) {
+        bolt_disconnect(bolt);
+        return NULL;
+    }
 
     return bolt;
 }
 
 void bolt_disconnect(Bolt *bolt)
 {
-    shutdown(bolt->socket, SHUT_RDWR);
+    if (bolt->socket >= 0) {
+        shutdown(bolt->socket, SHUT_RDWR);
+        close(bolt->socket);
+    }
+    delete[] bolt->read_buffer;
+    delete[] bolt->recv_buffer;
+    delete[] bolt->write_buffer;
+    delete[] bolt->segments;
+    delete[] bolt->in_flight;
+    arena_destroy(bolt->arena);
+    pool_destroy(bolt->pool);
+    intern_destroy(bolt->strings);
+    delete bolt;
+}
+
+bool bolt_set_nonblocking(Bolt *bolt, bool nonblocking)
+{
+    int flags = fcntl(bolt->socket, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
+    }
+    flags = nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return fcntl(bolt->socket, F_SETFL, flags) == 0;
+}
+
+// An idle connection has nothing to read, so any readable data or EOF means it is no longer usable
+bool bolt_alive(Bolt *bolt)
+{
+    if (bolt->defunct) {
+        return false;
+    }
+    char byte;
+    ssize_t received = recv(bolt->socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    BOLT_STAT_ADD(BOLT_STAT_RECV_CALLS, 1);
+    return received < 0 and (errno == EAGAIN or errno == EWOULDBLOCK);
+}
+
+bool bolt_reset(Bolt *bolt)
+{
+    if (bolt->defunct or bolt->receiving or bolt->recv_start != bolt->recv_end or bolt->in_flight_count > 0) {
+        return false;
+    }
+    bolt_reset_writer(bolt);
+    arena_reset(bolt->arena);
+    if (bolt->read_buffer_size > INITIAL_BUFFER_SIZE) {
+        bolt->message_size = 0;
+        bolt_resize_read_buffer(bolt, INITIAL_BUFFER_SIZE);
+    }
+    bolt->message_size = 0;
+    bolt->small_message_count = 0;
+    bolt->reader = bolt->read_buffer;
+    return true;
+}
+
+void bolt_handshake(Bolt *bolt)
+{
+    bolt_reserve_write_buffer(bolt, BOLT_HANDSHAKE_SIZE);
+    memcpy(bolt->writer, BOLT_HANDSHAKE, BOLT_HANDSHAKE_SIZE);
+    bolt->writer += BOLT_HANDSHAKE_SIZE;
+}
+
+bool bolt_read_version(Bolt *bolt)
+{
+    if (bolt->recv_end - bolt->recv_start < 4) {
+        return false;
+    }
+    const unsigned char *buffer = (const unsigned char *) bolt->recv_start;
+    bolt->version = (uint32_t) buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+    bolt->recv_start += 4;
+    return true;
 }
 
 void bolt_init(Bolt *bolt, const char *user_agent)
 {
+    BOLT_STAT_START(start);
     bolt_start_chunk(bolt);
+    bolt_reserve_write_buffer(bolt, 3);
     packstream_write_struct_header(&bolt->writer, 1, INIT_MESSAGE);
-    packstream_write_text(&bolt->writer, strlen(user_agent), user_agent);
+    bolt_write_text(bolt, strlen(user_agent), user_agent);
     bolt_end_chunk(bolt);
     bolt_end_message(bolt);
+    bolt_expect(bolt, INIT_MESSAGE);
+    BOLT_STAT_STOP(BOLT_STAT_ENCODE_NANOS, start);
 }
 
 void bolt_run(Bolt *bolt, const char *statement, size_t parameter_count, PackStream_Pair *parameters)
 {
+    BOLT_STAT_START(start);
     bolt_start_chunk(bolt);
+    bolt_reserve_write_buffer(bolt, 3);
     packstream_write_struct_header(&bolt->writer, 2, RUN_MESSAGE);
-    packstream_write_text(&bolt->writer, strlen(statement), statement);
-    packstream_write_map(&bolt->writer, parameter_count, parameters);
+    bolt_write_text(bolt, strlen(statement), statement);
+    bolt_write_map(bolt, parameter_count, parameters);
     bolt_end_chunk(bolt);
     bolt_end_message(bolt);
+    bolt_expect(bolt, RUN_MESSAGE);
+    BOLT_STAT_STOP(BOLT_STAT_ENCODE_NANOS, start);
 }
 
 void bolt_pull_all(Bolt *bolt)
 {
+    BOLT_STAT_START(start);
     bolt_start_chunk(bolt);
+    bolt_reserve_write_buffer(bolt, 3);
     packstream_write_struct_header(&bolt->writer, 0, PULL_ALL_MESSAGE);
     bolt_end_chunk(bolt);
     bolt_end_message(bolt);
+    bolt_expect(bolt, PULL_ALL_MESSAGE);
+    BOLT_STAT_STOP(BOLT_STAT_ENCODE_NANOS, start);
+}
+
+void bolt_ack_failure(Bolt *bolt)
+{
+    BOLT_STAT_START(start);
+    bolt_start_chunk(bolt);
+    bolt_reserve_write_buffer(bolt, 3);
+    packstream_write_struct_header(&bolt->writer, 0, ACK_FAILURE_MESSAGE);
+    bolt_end_chunk(bolt);
+    bolt_end_message(bolt);
+    bolt_expect(bolt, ACK_FAILURE_MESSAGE);
+    BOLT_STAT_STOP(BOLT_STAT_ENCODE_NANOS, start);
 }
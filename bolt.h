@@ -17,11 +17,35 @@
 #ifndef NEO4J_C_DRIVER_BOLT_H
 #define NEO4J_C_DRIVER_BOLT_H
 
+#include <netinet/in.h>
+
+#include "intern.h"
 #include "packstream.h"
 
 static const ssize_t INITIAL_BUFFER_SIZE = 65535;
+static const size_t DEFAULT_MAX_READ_BUFFER_SIZE = 0x4000000;
+static const size_t RECV_BUFFER_SIZE = 65536;
+static const size_t MAX_CHUNK_SIZE = 0xFFFF;
+static const size_t DIRECT_RECV_THRESHOLD = RECV_BUFFER_SIZE / 2;  // chunk bodies this long skip recv_buffer
+static const size_t ZERO_COPY_THRESHOLD = 4096;  // text and byte values at least this long are sent from caller memory
+static const int INITIAL_SEGMENT_CAPACITY = 16;
+static const int INITIAL_IN_FLIGHT_CAPACITY = 16;
+static const int READ_BUFFER_SHRINK_DELAY = 16;  // consecutive small messages before an oversized buffer is released
+
+static const uint32_t MAX_INTERNED_KEYS = 65536;  // beyond this, unseen keys are no longer added
+static const size_t MAX_INTERNED_KEY_SIZE = 256;
+
+// Keys interned by every connection before anything is received, so their IDs are fixed
+static const uint32_t BOLT_KEY_FIELDS = 0;
+static const uint32_t BOLT_KEY_CODE = 1;
+static const uint32_t BOLT_KEY_MESSAGE = 2;
+
+// Offers protocol version 1 only
+static const char BOLT_HANDSHAKE[] = "\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+static const size_t BOLT_HANDSHAKE_SIZE = 16;
 
 static const char INIT_MESSAGE = 0x01;
+static const char ACK_FAILURE_MESSAGE = 0x0E;
 static const char RUN_MESSAGE = 0x10;
 static const char PULL_ALL_MESSAGE = 0x3F;
 
@@ -30,38 +54,135 @@ static const char RECORD_MESSAGE = 0x71;
 static const char IGNORED_MESSAGE = 0x7E;
 static const char FAILURE_MESSAGE = 0x7F;
 
+// A run of outgoing bytes: either write_buffer[offset, offset + size) or, for
+// payloads too large to be worth copying, size bytes of caller-owned data
+struct Bolt_Segment
+{
+    const char *data;
+    size_t offset;
+    size_t size;
+};
+
 struct Bolt
 {
     int socket;
     uint32_t version;
+    bool defunct;                   // a send or receive failed, or a value could not be encoded, so the
+                                    // connection cannot be reused
+
+    // decoded values: the arena is reset by every bolt_recv, the pool keeps values until freed
+    Arena *arena;
+    Pool *pool;
+
+    // map keys, labels and field names seen on this connection
+    Intern_Table *strings;
 
-    // incoming
+    // incoming (text views read from here are valid until the next bolt_recv)
     char *read_buffer;
+    size_t read_buffer_size;
+    size_t max_read_buffer_size;    // messages larger than this are rejected
+    int small_message_count;
+
+    // bytes received from the socket but not yet consumed
+    char *recv_buffer;
+    char *recv_start;
+    char *recv_end;
+
     char *reader;
     int message_size;
     int message_field_count;
     char message_signature;
+    char message_request;           // the request a summary answers, or 0 for a RECORD
+
+    // progress through the message being received, which may arrive over several reads
+    bool receiving;
+    size_t chunk_remaining;
 
-    // outgoing
+    // outgoing (borrowed payloads must stay valid until the next bolt_send)
     char *write_buffer;
+    size_t write_buffer_size;
     char *writer;
     char *start_of_chunk;
+    size_t chunk_borrowed_size;
+    int chunk_segment_index;
+    size_t max_chunk_size;          // messages larger than this are split across chunks (at most MAX_CHUNK_SIZE)
+    size_t buffered_run_start;      // write_buffer offset at which the current run of buffered bytes began
+    Bolt_Segment *segments;
+    int segment_count;
+    int segment_capacity;
+    int send_next;                  // first segment not yet fully sent
+    size_t send_skip;               // bytes of that segment already sent
+
+    // requests awaiting their summary, oldest first: each message queued adds its signature
+    // here and each SUCCESS, FAILURE or IGNORED received removes one
+    char *in_flight;
+    int in_flight_head;
+    int in_flight_count;
+    int in_flight_capacity;
+    int acks_in_flight;
 
 };
 
 ssize_t bolt_send(Bolt *bolt);
 
+// Send as much of the queued data as the socket will take without blocking. Returns false if
+// the connection failed; bolt_sending is still true afterwards if the socket filled up.
+bool bolt_flush(Bolt *bolt);
+
+bool bolt_sending(Bolt *bolt);
+
 bool bolt_recv(Bolt *bolt);
 
+// Receive more bytes for the parser: the count, 0 at end of stream, or -1 with errno set
+ssize_t bolt_fill(Bolt *bolt);
+
+// Assemble the next message from bytes already received, resuming from wherever the
+// previous call stopped. Returns 1 for a complete message, 0 if more bytes are needed,
+// or -1 if the connection is unusable.
+int bolt_parse(Bolt *bolt);
+
+// Signature of the oldest request still awaiting a summary, or 0 if there is none
+char bolt_next_request(Bolt *bolt);
+
+// Read a text value from the current message as an interned key, which is INTERN_NONE
+// if the key is too long or too many distinct keys have been seen already
+bool bolt_read_key(Bolt *bolt, char **reader, uint32_t *key);
+
+// Set up the buffers for a connection over a socket that is, or will be, connected
+Bolt *bolt_create(int socket);
+
 Bolt *bolt_connect(const char *host, const in_port_t port);
 
+// Close the connection and free everything it holds
 void bolt_disconnect(Bolt *bolt);
 
+// Make socket operations return instead of waiting, for use with an event loop
+bool bolt_set_nonblocking(Bolt *bolt, bool nonblocking);
+
+// Check, without blocking, that an idle connection has not been closed by the server
+bool bolt_alive(Bolt *bolt);
+
+// Prepare an idle connection for its next user, keeping its buffers. Returns false if the
+// connection failed or has unread data, in which case it should be disconnected instead.
+bool bolt_reset(Bolt *bolt);
+
+// Queue the protocol version handshake, the first thing sent on a new connection
+void bolt_handshake(Bolt *bolt);
+
+// Take the server's choice of version from the bytes received, if all four have arrived
+bool bolt_read_version(Bolt *bolt);
+
+// Requests are only queued in the write buffer, so any number of them can be sent together by a
+// single bolt_send; their responses then arrive in the order the requests were queued
 void bolt_init(Bolt *bolt, const char *user_agent);
 
+// Text and byte values of ZERO_COPY_THRESHOLD bytes or more are sent straight from the
+// caller's memory, which must therefore stay valid until the next bolt_send
 void bolt_run(Bolt *bolt, const char *statement, size_t parameter_count, PackStream_Pair *parameters);
 
 void bolt_pull_all(Bolt *bolt);
 
+void bolt_ack_failure(Bolt *bolt);
+
 
 #endif // NEO4J_C_DRIVER_BOLT_H
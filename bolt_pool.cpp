@@ -0,0 +1,165 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "bolt_pool.h"
+
+int64_t bolt_pool_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+char *bolt_pool_copy_text(const char *text)
+{
+    size_t size = strlen(text);
+    char *copy = new char[size + 1];
+    memcpy(copy, text, size + 1);
+    return copy;
+}
+
+Bolt_Pool *bolt_pool_create(const char *host, in_port_t port, const char *user_agent, int max_size,
+                            int64_t idle_timeout)
+{
+    Bolt_Pool *pool = new Bolt_Pool;
+    pool->host = bolt_pool_copy_text(host);
+    pool->port = port;
+    pool->user_agent = bolt_pool_copy_text(user_agent);
+    pool->max_size = max_size > 0 ? max_size : 1;
+    pool->idle_timeout = idle_timeout;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->released, NULL);
+    pool->idle = new Bolt_Pool_Entry[pool->max_size];
+    pool->idle_count = 0;
+    pool->open_count = 0;
+    pool->connects = 0;
+    pool->reuses = 0;
+    pool->evictions = 0;
+    return pool;
+}
+
+void bolt_pool_destroy(Bolt_Pool *pool)
+{
+    for (int i = 0; i < pool->idle_count; i++) {
+        bolt_disconnect(pool->idle[i].bolt);
+    }
+    pthread_cond_destroy(&pool->released);
+    pthread_mutex_destroy(&pool->mutex);
+    delete[] pool->idle;
+    delete[] pool->host;
+    delete[] pool->user_agent;
+    delete pool;
+}
+
+// Called with the mutex held
+void bolt_pool_evict_locked(Bolt_Pool *pool, int64_t now)
+{
+    if (pool->idle_timeout <= 0) {
+        return;
+    }
+    int expired = 0;
+    while (expired < pool->idle_count and now - pool->idle[expired].idle_since > pool->idle_timeout) {
+        bolt_disconnect(pool->idle[expired].bolt);
+        expired += 1;
+    }
+    if (expired > 0) {
+        pool->idle_count -= expired;
+        memmove(pool->idle, pool->idle + expired, pool->idle_count * sizeof(Bolt_Pool_Entry));
+        pool->open_count -= expired;
+        pool->evictions += expired;
+        pthread_cond_broadcast(&pool->released);
+    }
+}
+
+void bolt_pool_evict(Bolt_Pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    bolt_pool_evict_locked(pool, bolt_pool_now());
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Connect, handshake and INIT, or NULL if any of them fails
+Bolt *bolt_pool_open(Bolt_Pool *pool)
+{
+    Bolt *bolt = bolt_connect(pool->host, pool->port);
+    if (bolt == NULL) {
+        return NULL;
+    }
+    bolt_init(bolt, pool->user_agent);
+    if (bolt_send(bolt) < 0 or !bolt_recv(bolt) or bolt->message_signature != SUCCESS_MESSAGE) {
+        bolt_disconnect(bolt);
+        return NULL;
+    }
+    return bolt;
+}
+
+Bolt *bolt_pool_acquire(Bolt_Pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        bolt_pool_evict_locked(pool, bolt_pool_now());
+        if (pool->idle_count > 0) {
+            pool->idle_count -= 1;
+            Bolt *bolt = pool->idle[pool->idle_count].bolt;
+            if (bolt_alive(bolt)) {
+                pool->reuses += 1;
+                pthread_mutex_unlock(&pool->mutex);
+                return bolt;
+            }
+            bolt_disconnect(bolt);
+            pool->open_count -= 1;
+        }
+        else if (pool->open_count < pool->max_size) {
+            // Claim the slot, then connect without holding the lock
+            pool->open_count += 1;
+            pool->connects += 1;
+            pthread_mutex_unlock(&pool->mutex);
+            Bolt *bolt = bolt_pool_open(pool);
+            if (bolt == NULL) {
+                pthread_mutex_lock(&pool->mutex);
+                pool->open_count -= 1;
+                pthread_cond_signal(&pool->released);
+                pthread_mutex_unlock(&pool->mutex);
+            }
+            return bolt;
+        }
+        else {
+            pthread_cond_wait(&pool->released, &pool->mutex);
+        }
+    }
+}
+
+void bolt_pool_release(Bolt_Pool *pool, Bolt *bolt)
+{
+    bool reusable = bolt_reset(bolt);
+    if (!reusable) {
+        bolt_disconnect(bolt);
+    }
+    pthread_mutex_lock(&pool->mutex);
+    if (reusable) {
+        pool->idle[pool->idle_count].bolt = bolt;
+        pool->idle[pool->idle_count].idle_since = bolt_pool_now();
+        pool->idle_count += 1;
+    }
+    else {
+        pool->open_count -= 1;
+    }
+    pthread_cond_signal(&pool->released);
+    pthread_mutex_unlock(&pool->mutex);
+}
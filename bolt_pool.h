@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_BOLT_POOL_H
+#define NEO4J_C_DRIVER_BOLT_POOL_H
+
+#include <pthread.h>
+
+#include "bolt.h"
+
+static const int64_t DEFAULT_POOL_IDLE_TIMEOUT = 60000;     // milliseconds
+
+struct Bolt_Pool_Entry
+{
+    Bolt *bolt;
+    int64_t idle_since;             // milliseconds on the monotonic clock
+};
+
+// Initialised connections shared between threads. Idle connections are kept most recently
+// used first, so the busiest stay warm and the oldest are the first to be evicted.
+struct Bolt_Pool
+{
+    char *host;
+    in_port_t port;
+    char *user_agent;
+    int max_size;
+    int64_t idle_timeout;           // milliseconds an idle connection is kept, or 0 to keep it forever
+
+    pthread_mutex_t mutex;
+    pthread_cond_t released;
+    Bolt_Pool_Entry *idle;          // oldest first
+    int idle_count;
+    int open_count;                 // idle and acquired, including those still connecting
+
+    // totals since the pool was created
+    unsigned long connects;
+    unsigned long reuses;
+    unsigned long evictions;
+};
+
+Bolt_Pool *bolt_pool_create(const char *host, in_port_t port, const char *user_agent, int max_size,
+                            int64_t idle_timeout);
+
+// Disconnect all idle connections and free the pool; every connection must have been released
+void bolt_pool_destroy(Bolt_Pool *pool);
+
+// An idle connection that is still alive, or a new one if there is none. Waits for a release
+// if max_size connections are already open, and returns NULL if a new connection fails.
+Bolt *bolt_pool_acquire(Bolt_Pool *pool);
+
+// Return a connection, which is kept for reuse unless it has failed or has unread data
+void bolt_pool_release(Bolt_Pool *pool, Bolt *bolt);
+
+// Disconnect connections that have been idle for longer than the idle timeout
+void bolt_pool_evict(Bolt_Pool *pool);
+
+
+#endif // NEO4J_C_DRIVER_BOLT_POOL_H
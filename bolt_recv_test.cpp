@@ -0,0 +1,117 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Receives records whose text values span several full chunks, sent by a bolt_stub started by
+// the test in small writes, so chunk bodies arrive both through recv_buffer and straight into
+// the read buffer. Run as bolt_recv_test <path to bolt_stub> [port].
+
+#include <cstdio>
+#include <cstdlib>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bolt.h"
+#include "cursor.h"
+
+static const size_t STUB_TEXT_SIZE = 100000;  // each value spans more than one chunk
+static const int STUB_FIELDS = 2;
+static const int STUB_RECORDS = 8;
+static const int STUB_FRAGMENT_SIZE = 1000;
+
+Bolt *recv_test_connect(in_port_t port)
+{
+    for (int attempt = 0; attempt < 50; attempt++) {
+        Bolt *bolt = bolt_connect("127.0.0.1", port);
+        if (bolt != NULL) {
+            return bolt;
+        }
+        usleep(100000);
+    }
+    return NULL;
+}
+
+// The stub fills every text value with the alphabet, repeated
+bool recv_test_check_text(Bolt_Cursor *cursor, int32_t index)
+{
+    int32_t size;
+    const char *value;
+    if (!bolt_cursor_text(cursor, index, &size, &value) or size != (int32_t) STUB_TEXT_SIZE) {
+        fprintf(stderr, "record %lu field %d: not text of the expected size\n", cursor->record_count, index);
+        return false;
+    }
+    for (int32_t i = 0; i < size; i++) {
+        if (value[i] != (char) ('a' + i % 26)) {
+            fprintf(stderr, "record %lu field %d: wrong byte at %d\n", cursor->record_count, index, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool recv_test_run(in_port_t port)
+{
+    Bolt *bolt = recv_test_connect(port);
+    if (bolt == NULL) {
+        fprintf(stderr, "Could not connect to bolt_stub\n");
+        return false;
+    }
+    bolt_run(bolt, "RETURN $text", 0, NULL);
+    bolt_pull_all(bolt);
+    bool passed = bolt_flush(bolt);
+    Bolt_Cursor *cursor = bolt_cursor_open(bolt);
+    while (passed and bolt_cursor_fetch(cursor)) {
+        for (int32_t field = 0; field < STUB_FIELDS; field++) {
+            passed = passed and recv_test_check_text(cursor, field);
+        }
+    }
+    if (passed and (cursor->state != BOLT_CURSOR_DONE or cursor->record_count != STUB_RECORDS)) {
+        fprintf(stderr, "state %d with %lu records\n", cursor->state, cursor->record_count);
+        passed = false;
+    }
+    bolt_cursor_close(cursor);
+    bolt_disconnect(bolt);
+    return passed;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: bolt_recv_test <bolt_stub> [port]\n");
+        return 2;
+    }
+    const char *port = argc > 2 ? argv[2] : "17688";
+    pid_t stub = fork();
+    if (stub == 0) {
+        char records[16], fields[16], text_size[16], fragment[16];
+        snprintf(records, sizeof records, "%d", STUB_RECORDS);
+        snprintf(fields, sizeof fields, "%d", STUB_FIELDS);
+        snprintf(text_size, sizeof text_size, "%zu", STUB_TEXT_SIZE);
+        snprintf(fragment, sizeof fragment, "%d", STUB_FRAGMENT_SIZE);
+        execl(argv[1], "bolt_stub", "--port", port, "--records", records, "--fields", fields, "--values", "text",
+              "--text-size", text_size, "--fragment", fragment, (char *) NULL);
+        perror("Could not start bolt_stub");
+        _exit(2);
+    }
+
+    bool passed = recv_test_run((in_port_t) strtoul(port, NULL, 10));
+
+    kill(stub, SIGTERM);
+    waitpid(stub, NULL, 0);
+    puts(passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
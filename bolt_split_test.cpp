@@ -0,0 +1,142 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sends a message too large for one chunk while an earlier send is still partly queued, then
+// checks that a bolt_stub started by the test answers every request. Run as
+// bolt_split_test <path to bolt_stub> [port].
+
+#include <cstdio>
+#include <cstdlib>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bolt.h"
+#include "cursor.h"
+
+static const size_t LARGE_PARAMETER_SIZE = 0x400000;    // more than the socket buffers can take at once
+static const size_t SPLIT_STATEMENT_SIZE = 2000;        // buffered, as it is under ZERO_COPY_THRESHOLD
+static const size_t SPLIT_CHUNK_SIZE = 256;
+static const int STUB_RECORDS = 3;
+
+Bolt *split_test_connect(in_port_t port)
+{
+    for (int attempt = 0; attempt < 50; attempt++) {
+        Bolt *bolt = bolt_connect("127.0.0.1", port);
+        if (bolt != NULL) {
+            return bolt;
+        }
+        usleep(100000);
+    }
+    return NULL;
+}
+
+// Read the results of a RUN/PULL_ALL pair, which must succeed with every record
+bool split_test_check_result(Bolt *bolt, const char *name)
+{
+    Bolt_Cursor *cursor = bolt_cursor_open(bolt);
+    while (bolt_cursor_fetch(cursor)) {
+    }
+    bool passed = cursor->state == BOLT_CURSOR_DONE and cursor->record_count == STUB_RECORDS;
+    if (!passed) {
+        fprintf(stderr, "%s: state %d with %lu records (%s)\n", name, cursor->state, cursor->record_count,
+                cursor->failure_message != NULL ? cursor->failure_message : "no failure");
+    }
+    bolt_cursor_close(cursor);
+    return passed;
+}
+
+bool split_test_run(in_port_t port)
+{
+    Bolt *bolt = split_test_connect(port);
+    if (bolt == NULL) {
+        fprintf(stderr, "Could not connect to bolt_stub\n");
+        return false;
+    }
+    int send_buffer_size = 65536;
+    setsockopt(bolt->socket, SOL_SOCKET, SO_SNDBUF, &send_buffer_size, sizeof send_buffer_size);
+    bolt_set_nonblocking(bolt, true);
+
+    // A borrowed parameter far larger than the socket buffers leaves the first pair partly sent
+    char *large = new char[LARGE_PARAMETER_SIZE];
+    memset(large, 'x', LARGE_PARAMETER_SIZE);
+    PackStream_Pair parameter;
+    parameter.name.type = PACKSTREAM_TEXT;
+    parameter.name.size = 1;
+    parameter.name.value = (void *) "x";
+    parameter.value.type = PACKSTREAM_TEXT;
+    parameter.value.size = LARGE_PARAMETER_SIZE;
+    parameter.value.value = large;
+    bolt_run(bolt, "RETURN $x", 1, &parameter);
+    bolt_pull_all(bolt);
+    bool passed = bolt_flush(bolt);
+    if (passed and !bolt_sending(bolt)) {
+        fprintf(stderr, "The first send was not partial, so the split was not exercised\n");
+        passed = false;
+    }
+
+    // The next message's header continues the buffered run still queued, and its body is
+    // buffered too, so the split must find the header inside that earlier segment
+    char statement[SPLIT_STATEMENT_SIZE + 1];
+    memcpy(statement, "RETURN 1 //", 11);
+    memset(statement + 11, 'y', SPLIT_STATEMENT_SIZE - 11);
+    statement[SPLIT_STATEMENT_SIZE] = '\0';
+    bolt->max_chunk_size = SPLIT_CHUNK_SIZE;
+    bolt_run(bolt, statement, 0, NULL);
+    bolt_pull_all(bolt);
+
+    while (passed and bolt_sending(bolt)) {
+        struct pollfd ready;
+        ready.fd = bolt->socket;
+        ready.events = POLLOUT;
+        poll(&ready, 1, 1000);
+        passed = bolt_flush(bolt);
+    }
+    bolt_set_nonblocking(bolt, false);
+    passed = passed and split_test_check_result(bolt, "large parameter") and
+             split_test_check_result(bolt, "split statement");
+
+    bolt_disconnect(bolt);
+    delete[] large;
+    return passed;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: bolt_split_test <bolt_stub> [port]\n");
+        return 2;
+    }
+    const char *port = argc > 2 ? argv[2] : "17687";
+    pid_t stub = fork();
+    if (stub == 0) {
+        char records[16];
+        snprintf(records, sizeof records, "%d", STUB_RECORDS);
+        execl(argv[1], "bolt_stub", "--port", port, "--records", records, (char *) NULL);
+        perror("Could not start bolt_stub");
+        _exit(2);
+    }
+
+    bool passed = split_test_run((in_port_t) strtoul(port, NULL, 10));
+
+    kill(stub, SIGTERM);
+    waitpid(stub, NULL, 0);
+    puts(passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
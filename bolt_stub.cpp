@@ -0,0 +1,475 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A stub Bolt server that answers from generated, pre-encoded responses, so that the
+// driver can be benchmarked without a database. Each connection gets its own thread.
+
+#include <errno.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "packstream.h"
+
+using namespace std;
+
+static const size_t STUB_HANDSHAKE_SIZE = 16;
+static const size_t STUB_RECV_SIZE = 131072;      // room for a whole chunk of the largest size
+static const size_t STUB_MAX_CHUNK_SIZE = 65535;
+
+static const char INIT_MESSAGE = 0x01;
+static const char ACK_FAILURE_MESSAGE = 0x0E;
+static const char RESET_MESSAGE = 0x0F;
+static const char RUN_MESSAGE = 0x10;
+static const char DISCARD_ALL_MESSAGE = 0x2F;
+static const char PULL_ALL_MESSAGE = 0x3F;
+static const char SUCCESS_MESSAGE = 0x70;
+static const char RECORD_MESSAGE = 0x71;
+static const char IGNORED_MESSAGE = 0x7E;
+static const char FAILURE_MESSAGE = 0x7F;
+
+// Statements starting with this fail, so that failure handling can be exercised too
+static const char STUB_FAIL_PREFIX[] = "FAIL";
+
+enum Stub_Values
+{
+    STUB_INTEGERS,
+    STUB_FLOATS,
+    STUB_TEXT,
+    STUB_MIXED,
+};
+
+struct Stub_Options
+{
+    in_port_t port;
+    unsigned long records;          // per PULL_ALL
+    unsigned int fields;
+    Stub_Values values;
+    size_t text_size;
+    size_t max_chunk_size;          // larger messages are split into several chunks
+    size_t fragment_size;           // send responses in writes of at most this many bytes, or 0
+    unsigned int latency;           // microseconds to wait before answering each batch of requests
+};
+
+struct Stub_Buffer
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+// Encoded once at startup and shared by every connection
+struct Stub_Responses
+{
+    Stub_Buffer success;
+    Stub_Buffer run_success;
+    Stub_Buffer pull_all;           // every record followed by the summary
+    Stub_Buffer failure;
+    Stub_Buffer ignored;
+};
+
+void stub_buffer_init(Stub_Buffer *buffer, size_t capacity)
+{
+    buffer->data = new char[capacity];
+    buffer->size = 0;
+    buffer->capacity = capacity;
+}
+
+void stub_buffer_reserve(Stub_Buffer *buffer, size_t size)
+{
+    if (buffer->size + size <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = buffer->capacity * 2;
+    while (capacity < buffer->size + size) {
+        capacity *= 2;
+    }
+    char *data = new char[capacity];
+    memcpy(data, buffer->data, buffer->size);
+    delete[] buffer->data;
+    buffer->data = data;
+    buffer->capacity = capacity;
+}
+
+void stub_buffer_append(Stub_Buffer *buffer, const char *data, size_t size)
+{
+    stub_buffer_reserve(buffer, size);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// Append one message, framed as chunks of at most max_chunk_size bytes
+void stub_frame(Stub_Buffer *buffer, const char *message, size_t size, size_t max_chunk_size)
+{
+    size_t position = 0;
+    while (position < size) {
+        size_t chunk_size = size - position < max_chunk_size ? size - position : max_chunk_size;
+        char header[2] = {(char) (chunk_size >> 8), (char) (chunk_size & 0xFF)};
+        stub_buffer_append(buffer, header, 2);
+        stub_buffer_append(buffer, message + position, chunk_size);
+        position += chunk_size;
+    }
+    char end[2] = {0, 0};
+    stub_buffer_append(buffer, end, 2);
+}
+
+void stub_encode_value(char **writer, const Stub_Options *options, unsigned long row, unsigned int field,
+                       const char *text)
+{
+    Stub_Values values = options->values;
+    if (values == STUB_MIXED) {
+        values = (Stub_Values) (field % 3);
+    }
+    switch (values) {
+        case STUB_INTEGERS:
+            packstream_write_integer(writer, (int64_t) (row * options->fields + field));
+            break;
+        case STUB_FLOATS:
+            packstream_write_float(writer, row + field / 10.0);
+            break;
+        default:
+            packstream_write_text(writer, options->text_size, text);
+    }
+}
+
+void stub_encode_responses(Stub_Responses *responses, const Stub_Options *options)
+{
+    size_t max_chunk_size = options->max_chunk_size;
+    // The largest message is a record, or the RUN summary's field names
+    size_t message_capacity = 64 + options->fields * (options->text_size + 16);
+    char *message = new char[message_capacity];
+    char *text = new char[options->text_size + 1];
+    for (size_t i = 0; i < options->text_size; i++) {
+        text[i] = (char) ('a' + i % 26);
+    }
+    char *writer;
+
+    stub_buffer_init(&responses->success, 16);
+    writer = message;
+    packstream_write_struct_header(&writer, 1, SUCCESS_MESSAGE);
+    packstream_write_map_header(&writer, 0);
+    stub_frame(&responses->success, message, writer - message, max_chunk_size);
+
+    stub_buffer_init(&responses->run_success, 256);
+    writer = message;
+    packstream_write_struct_header(&writer, 1, SUCCESS_MESSAGE);
+    packstream_write_map_header(&writer, 1);
+    packstream_write_text(&writer, 6, "fields");
+    packstream_write_list_header(&writer, options->fields);
+    for (unsigned int field = 0; field < options->fields; field++) {
+        char name[16];
+        int size = snprintf(name, sizeof name, "f%u", field);
+        packstream_write_text(&writer, (size_t) size, name);
+    }
+    stub_frame(&responses->run_success, message, writer - message, max_chunk_size);
+
+    stub_buffer_init(&responses->pull_all, 4096);
+    for (unsigned long row = 0; row < options->records; row++) {
+        writer = message;
+        packstream_write_struct_header(&writer, 1, RECORD_MESSAGE);
+        packstream_write_list_header(&writer, options->fields);
+        for (unsigned int field = 0; field < options->fields; field++) {
+            stub_encode_value(&writer, options, row, field, text);
+        }
+        stub_frame(&responses->pull_all, message, writer - message, max_chunk_size);
+    }
+    stub_buffer_append(&responses->pull_all, responses->success.data, responses->success.size);
+
+    stub_buffer_init(&responses->failure, 128);
+    writer = message;
+    const char *code = "Neo.ClientError.Statement.SyntaxError";
+    const char *failure_message = "Statement failed by request";
+    packstream_write_struct_header(&writer, 1, FAILURE_MESSAGE);
+    packstream_write_map_header(&writer, 2);
+    packstream_write_text(&writer, 4, "code");
+    packstream_write_text(&writer, strlen(code), code);
+    packstream_write_text(&writer, 7, "message");
+    packstream_write_text(&writer, strlen(failure_message), failure_message);
+    stub_frame(&responses->failure, message, writer - message, max_chunk_size);
+
+    stub_buffer_init(&responses->ignored, 16);
+    writer = message;
+    packstream_write_struct_header(&writer, 0, IGNORED_MESSAGE);
+    stub_frame(&responses->ignored, message, writer - message, max_chunk_size);
+
+    delete[] text;
+    delete[] message;
+}
+
+bool stub_send(int socket, const char *data, size_t size, size_t fragment_size)
+{
+    while (size > 0) {
+        size_t piece = fragment_size > 0 and fragment_size < size ? fragment_size : size;
+        ssize_t sent = send(socket, data, piece, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+bool stub_read_handshake(int socket)
+{
+    char handshake[STUB_HANDSHAKE_SIZE];
+    size_t received = 0;
+    while (received < STUB_HANDSHAKE_SIZE) {
+        ssize_t size = recv(socket, handshake + received, STUB_HANDSHAKE_SIZE - received, 0);
+        if (size <= 0) {
+            return false;
+        }
+        received += (size_t) size;
+    }
+    // Only version 1 is spoken; any proposal of it is accepted
+    for (size_t offset = 0; offset < STUB_HANDSHAKE_SIZE; offset += 4) {
+        if (handshake[offset] == 0 and handshake[offset + 1] == 0 and handshake[offset + 2] == 0 and
+            handshake[offset + 3] == 1) {
+            return stub_send(socket, "\x00\x00\x00\x01", 4, 0);
+        }
+    }
+    stub_send(socket, "\x00\x00\x00\x00", 4, 0);
+    return false;
+}
+
+// Append the response to one request. After a failure, everything up to the next
+// ACK_FAILURE or RESET is ignored, as a server would.
+void stub_respond(Stub_Buffer *output, char *message, const Stub_Responses *responses, bool *failed)
+{
+    int32_t field_count;
+    char signature;
+    if (!packstream_read_structure_header(&message, &field_count, &signature)) {
+        signature = 0;
+    }
+    if (signature == ACK_FAILURE_MESSAGE or signature == RESET_MESSAGE) {
+        *failed = false;
+        stub_buffer_append(output, responses->success.data, responses->success.size);
+        return;
+    }
+    if (*failed) {
+        stub_buffer_append(output, responses->ignored.data, responses->ignored.size);
+        return;
+    }
+    switch (signature) {
+        case RUN_MESSAGE: {
+            int32_t size;
+            const char *statement;
+            if (packstream_read_text_view(&message, &size, &statement) and
+                (size_t) size >= sizeof STUB_FAIL_PREFIX - 1 and
+                memcmp(statement, STUB_FAIL_PREFIX, sizeof STUB_FAIL_PREFIX - 1) == 0) {
+                *failed = true;
+                stub_buffer_append(output, responses->failure.data, responses->failure.size);
+            }
+            else {
+                stub_buffer_append(output, responses->run_success.data, responses->run_success.size);
+            }
+            break;
+        }
+        case PULL_ALL_MESSAGE:
+            stub_buffer_append(output, responses->pull_all.data, responses->pull_all.size);
+            break;
+        case INIT_MESSAGE:
+        case DISCARD_ALL_MESSAGE:
+            stub_buffer_append(output, responses->success.data, responses->success.size);
+            break;
+        default:
+            *failed = true;
+            stub_buffer_append(output, responses->failure.data, responses->failure.size);
+    }
+}
+
+void stub_serve(int socket, const Stub_Options *options, const Stub_Responses *responses)
+{
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    if (!stub_read_handshake(socket)) {
+        close(socket);
+        return;
+    }
+
+    char *input = new char[STUB_RECV_SIZE];
+    size_t input_size = 0;
+    Stub_Buffer message;
+    stub_buffer_init(&message, 4096);
+    Stub_Buffer output;
+    stub_buffer_init(&output, 4096);
+    bool failed = false;
+    for (;;) {
+        ssize_t received = recv(socket, input + input_size, STUB_RECV_SIZE - input_size, 0);
+        if (received < 0 and errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        input_size += (size_t) received;
+
+        // Answer every complete request received so far in a single batch
+        size_t position = 0;
+        for (;;) {
+            if (input_size - position < 2) {
+                break;
+            }
+            size_t chunk_size = (size_t) ((unsigned char) input[position] << 8 | (unsigned char) input[position + 1]);
+            if (input_size - position - 2 < chunk_size) {
+                break;
+            }
+            position += 2;
+            if (chunk_size == 0) {
+                if (message.size > 0) {
+                    stub_respond(&output, message.data, responses, &failed);
+                    message.size = 0;
+                }
+                continue;
+            }
+            stub_buffer_append(&message, input + position, chunk_size);
+            position += chunk_size;
+        }
+        memmove(input, input + position, input_size - position);
+        input_size -= position;
+
+        if (output.size > 0) {
+            if (options->latency > 0) {
+                usleep(options->latency);
+            }
+            if (!stub_send(socket, output.data, output.size, options->fragment_size)) {
+                break;
+            }
+            output.size = 0;
+        }
+    }
+    delete[] output.data;
+    delete[] message.data;
+    delete[] input;
+    close(socket);
+}
+
+int print_help()
+{
+    puts("usage: bolt_stub [--port N] [--records N] [--fields N] [--values int|float|text|mixed]\n"
+         "                 [--text-size N] [--max-chunk-size N] [--fragment N] [--latency MICROSECONDS]");
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    Stub_Options options;
+    options.port = 7687;
+    options.records = 1;
+    options.fields = 1;
+    options.values = STUB_INTEGERS;
+    options.text_size = 16;
+    options.max_chunk_size = STUB_MAX_CHUNK_SIZE;
+    options.fragment_size = 0;
+    options.latency = 0;
+    for (int arg = 1; arg < argc; arg += 2) {
+        if (arg + 1 >= argc) {
+            return print_help();
+        }
+        const char *option = argv[arg];
+        const char *value = argv[arg + 1];
+        if (strcmp(option, "--port") == 0) {
+            options.port = (in_port_t) strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--records") == 0) {
+            options.records = strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--fields") == 0) {
+            options.fields = (unsigned int) strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--values") == 0) {
+            if (strcmp(value, "int") == 0) {
+                options.values = STUB_INTEGERS;
+            }
+            else if (strcmp(value, "float") == 0) {
+                options.values = STUB_FLOATS;
+            }
+            else if (strcmp(value, "text") == 0) {
+                options.values = STUB_TEXT;
+            }
+            else if (strcmp(value, "mixed") == 0) {
+                options.values = STUB_MIXED;
+            }
+            else {
+                return print_help();
+            }
+        }
+        else if (strcmp(option, "--text-size") == 0) {
+            options.text_size = strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--max-chunk-size") == 0) {
+            options.max_chunk_size = strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--fragment") == 0) {
+            options.fragment_size = strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--latency") == 0) {
+            options.latency = (unsigned int) strtoul(value, NULL, 10);
+        }
+        else {
+            return print_help();
+        }
+    }
+    if (options.max_chunk_size == 0 or options.max_chunk_size > STUB_MAX_CHUNK_SIZE) {
+        return print_help();
+    }
+
+    Stub_Responses responses;
+    stub_encode_responses(&responses, &options);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == -1) {
+        perror("Could not create socket");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(options.port);
+    if (bind(listener, (struct sockaddr *) &address, sizeof address) < 0 or listen(listener, 128) < 0) {
+        perror("Could not listen");
+        close(listener);
+        return 1;
+    }
+    printf("Listening on 127.0.0.1:%u\n", (unsigned int) options.port);
+    fflush(stdout);
+
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept failed");
+            break;
+        }
+        thread(stub_serve, client, &options, &responses).detach();
+    }
+    close(listener);
+    return 1;
+}
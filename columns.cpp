@@ -0,0 +1,297 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "columns.h"
+
+static const size_t INITIAL_COLUMN_ROWS = 1024;
+static const size_t INITIAL_COLUMN_DATA = 16384;
+
+// Allocate the value buffer for a column whose type has just become known.
+// Rows before this one were null, so their slots are zeroed.
+void bolt_column_set_type(Bolt_Column *column, Bolt_Column_Type type, size_t capacity, size_t row_count)
+{
+    column->type = type;
+    switch (type) {
+        case BOLT_COLUMN_INTEGER:
+            column->integers = new int64_t[capacity];
+            memset(column->integers, 0, row_count * sizeof(int64_t));
+            break;
+        case BOLT_COLUMN_FLOAT:
+            column->floats = new double[capacity];
+            memset(column->floats, 0, row_count * sizeof(double));
+            break;
+        case BOLT_COLUMN_TEXT:
+            column->offsets = new int32_t[capacity + 1];
+            memset(column->offsets, 0, (row_count + 1) * sizeof(int32_t));
+            column->data_capacity = INITIAL_COLUMN_DATA;
+            column->data = new char[column->data_capacity];
+            column->data_size = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+// An integer column becomes a float column, converting the values already stored
+void bolt_column_widen(Bolt_Column *column, size_t capacity, size_t row_count)
+{
+    double *floats = new double[capacity];
+    for (size_t i = 0; i < row_count; i++) {
+        floats[i] = (double) column->integers[i];
+    }
+    delete[] column->integers;
+    column->integers = NULL;
+    column->floats = floats;
+    column->type = BOLT_COLUMN_FLOAT;
+}
+
+template <typename T>
+void bolt_column_resize(T **values, size_t old_size, size_t new_size)
+{
+    if (*values == NULL) {
+        return;
+    }
+    T *resized = new T[new_size];
+    memcpy(resized, *values, old_size * sizeof(T));
+    delete[] *values;
+    *values = resized;
+}
+
+void bolt_columns_reserve_row(Bolt_Columns *columns)
+{
+    if (columns->row_count < columns->row_capacity) {
+        return;
+    }
+    size_t old_capacity = columns->row_capacity;
+    size_t new_capacity = old_capacity * 2;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        Bolt_Column *column = &columns->columns[c];
+        bolt_column_resize(&column->validity, old_capacity / 8, new_capacity / 8);
+        memset(column->validity + old_capacity / 8, 0, (new_capacity - old_capacity) / 8);
+        bolt_column_resize(&column->integers, old_capacity, new_capacity);
+        bolt_column_resize(&column->floats, old_capacity, new_capacity);
+        bolt_column_resize(&column->offsets, old_capacity + 1, new_capacity + 1);
+    }
+    columns->row_capacity = new_capacity;
+}
+
+void bolt_column_append_text(Bolt_Column *column, size_t row, const char *value, int32_t size)
+{
+    if (column->data_size + size > column->data_capacity) {
+        size_t capacity = column->data_capacity * 2;
+        while (capacity < column->data_size + size) {
+            capacity *= 2;
+        }
+        bolt_column_resize(&column->data, column->data_size, capacity);
+        column->data_capacity = capacity;
+    }
+    memcpy(column->data + column->data_size, value, (size_t) size);
+    column->data_size += size;
+    column->offsets[row + 1] = (int32_t) column->data_size;
+}
+
+// Store the value at the reader in a row that is null until proven otherwise
+void bolt_column_append(Bolt_Column *column, size_t row, size_t capacity, bool types_locked, char **reader)
+{
+    PackStream_Type type = packstream_next_type(*reader);
+    if (!types_locked and column->type == BOLT_COLUMN_UNKNOWN) {
+        if (type == PACKSTREAM_INTEGER) {
+            bolt_column_set_type(column, BOLT_COLUMN_INTEGER, capacity, row);
+        }
+        else if (type == PACKSTREAM_FLOAT) {
+            bolt_column_set_type(column, BOLT_COLUMN_FLOAT, capacity, row);
+        }
+        else if (type == PACKSTREAM_TEXT) {
+            bolt_column_set_type(column, BOLT_COLUMN_TEXT, capacity, row);
+        }
+    }
+    else if (!types_locked and column->type == BOLT_COLUMN_INTEGER and type == PACKSTREAM_FLOAT) {
+        bolt_column_widen(column, capacity, row);
+    }
+
+    bool stored = false;
+    switch (column->type) {
+        case BOLT_COLUMN_INTEGER:
+            column->integers[row] = 0;
+            stored = type == PACKSTREAM_INTEGER and packstream_read_integer(reader, &column->integers[row]);
+            break;
+        case BOLT_COLUMN_FLOAT: {
+            column->floats[row] = 0.0;
+            if (type == PACKSTREAM_FLOAT) {
+                stored = packstream_read_float(reader, &column->floats[row]);
+            }
+            else if (type == PACKSTREAM_INTEGER) {
+                int64_t value;
+                stored = packstream_read_integer(reader, &value);
+                column->floats[row] = (double) value;
+            }
+            break;
+        }
+        case BOLT_COLUMN_TEXT: {
+            column->offsets[row + 1] = (int32_t) column->data_size;
+            int32_t size;
+            const char *value;
+            if (type == PACKSTREAM_TEXT and packstream_read_text_view(reader, &size, &value)) {
+                bolt_column_append_text(column, row, value, size);
+                stored = true;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (stored) {
+        column->validity[row / 8] |= (uint8_t) (1 << (row % 8));
+        return;
+    }
+    column->null_count += 1;
+    if (type != PACKSTREAM_NULL) {
+        column->rejected_count += 1;
+    }
+    packstream_skip(reader);
+}
+
+Bolt_Columns *bolt_columns_create(Bolt_Cursor *cursor)
+{
+    Bolt_Columns *columns = new Bolt_Columns;
+    columns->cursor = cursor;
+    columns->column_count = cursor->field_count;
+    columns->columns = new Bolt_Column[columns->column_count > 0 ? columns->column_count : 1];
+    columns->row_count = 0;
+    columns->row_capacity = INITIAL_COLUMN_ROWS;
+    columns->types_locked = false;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        Bolt_Column *column = &columns->columns[c];
+        column->type = BOLT_COLUMN_UNKNOWN;
+        column->validity = new uint8_t[columns->row_capacity / 8];
+        memset(column->validity, 0, columns->row_capacity / 8);
+        column->integers = NULL;
+        column->floats = NULL;
+        column->offsets = NULL;
+        column->data = NULL;
+        column->data_size = 0;
+        column->data_capacity = 0;
+        column->null_count = 0;
+        column->rejected_count = 0;
+    }
+    return columns;
+}
+
+void bolt_columns_destroy(Bolt_Columns *columns)
+{
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        Bolt_Column *column = &columns->columns[c];
+        delete[] column->validity;
+        delete[] column->integers;
+        delete[] column->floats;
+        delete[] column->offsets;
+        delete[] column->data;
+    }
+    delete[] columns->columns;
+    delete columns;
+}
+
+void bolt_columns_clear(Bolt_Columns *columns)
+{
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        Bolt_Column *column = &columns->columns[c];
+        memset(column->validity, 0, (columns->row_count + 7) / 8);
+        column->data_size = 0;
+        column->null_count = 0;
+    }
+    columns->row_count = 0;
+}
+
+void bolt_columns_lock_types(Bolt_Columns *columns)
+{
+    columns->types_locked = true;
+}
+
+void bolt_columns_append(Bolt_Columns *columns, Bolt_Cursor *cursor)
+{
+    bolt_columns_reserve_row(columns);
+    size_t row = columns->row_count;
+    // Fields are consumed in order, so the record is walked once without indexing it
+    char *reader = cursor->record_size > 0 ? cursor->value_starts[0] : NULL;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        Bolt_Column *column = &columns->columns[c];
+        if (c < cursor->record_size) {
+            bolt_column_append(column, row, columns->row_capacity, columns->types_locked, &reader);
+            continue;
+        }
+        // A short record leaves the remaining columns null
+        column->null_count += 1;
+        if (column->type == BOLT_COLUMN_TEXT) {
+            column->offsets[row + 1] = (int32_t) column->data_size;
+        }
+        else if (column->type == BOLT_COLUMN_INTEGER) {
+            column->integers[row] = 0;
+        }
+        else if (column->type == BOLT_COLUMN_FLOAT) {
+            column->floats[row] = 0.0;
+        }
+    }
+    columns->row_count += 1;
+}
+
+size_t bolt_columns_fill(Bolt_Columns *columns, Bolt_Cursor *cursor, size_t max_rows, size_t max_bytes)
+{
+    size_t appended = 0;
+    while ((max_rows == 0 or columns->row_count < max_rows) and
+           (max_bytes == 0 or bolt_columns_size(columns) < max_bytes) and bolt_cursor_fetch(cursor)) {
+        bolt_columns_append(columns, cursor);
+        appended += 1;
+    }
+    return appended;
+}
+
+size_t bolt_columns_size(const Bolt_Columns *columns)
+{
+    size_t size = 0;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        const Bolt_Column *column = &columns->columns[c];
+        size += (columns->row_count + 7) / 8;
+        if (column->type == BOLT_COLUMN_TEXT) {
+            size += (columns->row_count + 1) * sizeof(int32_t) + column->data_size;
+        }
+        else if (column->type != BOLT_COLUMN_UNKNOWN) {
+            size += columns->row_count * sizeof(int64_t);
+        }
+    }
+    return size;
+}
+
+const char *bolt_columns_name(const Bolt_Columns *columns, int32_t index, size_t *size)
+{
+    return bolt_cursor_field_name(columns->cursor, index, size);
+}
+
+bool bolt_columns_is_null(const Bolt_Column *column, size_t row)
+{
+    return (column->validity[row / 8] & (1 << (row % 8))) == 0;
+}
+
+const char *bolt_columns_text(const Bolt_Column *column, size_t row, int32_t *size)
+{
+    if (column->type != BOLT_COLUMN_TEXT) {
+        return NULL;
+    }
+    *size = column->offsets[row + 1] - column->offsets[row];
+    return column->data + column->offsets[row];
+}
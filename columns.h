@@ -0,0 +1,87 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_COLUMNS_H
+#define NEO4J_C_DRIVER_COLUMNS_H
+
+#include "cursor.h"
+
+enum Bolt_Column_Type {
+    BOLT_COLUMN_UNKNOWN = 0,        // only nulls seen so far
+    BOLT_COLUMN_INTEGER = 1,
+    BOLT_COLUMN_FLOAT = 2,
+    BOLT_COLUMN_TEXT = 3,
+};
+
+// One field of a result, stored contiguously. The type is taken from the first non-null value;
+// an integer column turns into a float column if a float arrives, and values that fit neither
+// (or lists, maps and structures) are stored as null and counted as rejected.
+struct Bolt_Column
+{
+    Bolt_Column_Type type;
+
+    uint8_t *validity;              // bit i (least significant first) is set if row i is not null
+    int64_t *integers;              // for integer columns
+    double *floats;                 // for float columns
+    int32_t *offsets;               // for text columns, row_count + 1 offsets into data
+    char *data;
+    size_t data_size;
+    size_t data_capacity;
+
+    size_t null_count;              // in the current batch
+    size_t rejected_count;          // since the columns were created, as clearing keeps it
+};
+
+// Typed column buffers for records read from a cursor, laid out by the fields of the RUN summary
+struct Bolt_Columns
+{
+    Bolt_Cursor *cursor;            // whose fields name the columns
+    int32_t column_count;
+    Bolt_Column *columns;
+    size_t row_count;
+    size_t row_capacity;
+    bool types_locked;              // once set, columns neither take a type nor widen
+};
+
+Bolt_Columns *bolt_columns_create(Bolt_Cursor *cursor);
+
+void bolt_columns_destroy(Bolt_Columns *columns);
+
+// Remove every row, keeping the column types, rejected counts and the memory for reuse by the next batch
+void bolt_columns_clear(Bolt_Columns *columns);
+
+// Keep every column at its current type, as when later batches must match a schema already
+// written. A column still of unknown type then only holds nulls.
+void bolt_columns_lock_types(Bolt_Columns *columns);
+
+// Decode the cursor's current record into a new row
+void bolt_columns_append(Bolt_Columns *columns, Bolt_Cursor *cursor);
+
+// Fetch and append records until the cursor ends or the batch reaches `max_rows` rows or
+// `max_bytes` bytes (0 for no limit). Returns the number of rows appended.
+size_t bolt_columns_fill(Bolt_Columns *columns, Bolt_Cursor *cursor, size_t max_rows, size_t max_bytes);
+
+// Bytes held by the rows of the batch, not counting spare capacity
+size_t bolt_columns_size(const Bolt_Columns *columns);
+
+const char *bolt_columns_name(const Bolt_Columns *columns, int32_t index, size_t *size);
+
+bool bolt_columns_is_null(const Bolt_Column *column, size_t row);
+
+const char *bolt_columns_text(const Bolt_Column *column, size_t row, int32_t *size);
+
+
+#endif // NEO4J_C_DRIVER_COLUMNS_H
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "cursor.h"
+
+void bolt_cursor_fail(Bolt_Cursor *cursor, const char *message)
+{
+    cursor->state = BOLT_CURSOR_FAILED;
+    if (cursor->failure_message == NULL) {
+        cursor->failure_message = pool_copy_text(cursor->bolt->pool, message, strlen(message));
+    }
+}
+
+// Keep the code and message of a FAILURE message; the server now ignores everything until ACK_FAILURE
+void bolt_cursor_read_failure(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    cursor->state = BOLT_CURSOR_FAILED;
+    cursor->failure_pending = true;
+    int32_t size;
+    if (!packstream_read_map_header(&bolt->reader, &size)) {
+        return;
+    }
+    for (int32_t i = 0; i < size; i++) {
+        uint32_t key = INTERN_NONE;
+        bolt_read_key(bolt, &bolt->reader, &key);
+        int32_t value_size;
+        const char *value;
+        if (key == BOLT_KEY_CODE and
+            packstream_read_text_view(&bolt->reader, &value_size, &value)) {
+            cursor->failure_code = pool_copy_text(bolt->pool, value, (size_t) value_size);
+        }
+        else if (key == BOLT_KEY_MESSAGE and
+                 packstream_read_text_view(&bolt->reader, &value_size, &value)) {
+            cursor->failure_message = pool_copy_text(bolt->pool, value, (size_t) value_size);
+        }
+        else {
+            packstream_skip(&bolt->reader);
+        }
+    }
+}
+
+void bolt_cursor_read_fields(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    int32_t size;
+    if (!packstream_read_map_header(&bolt->reader, &size)) {
+        return;
+    }
+    for (int32_t i = 0; i < size; i++) {
+        uint32_t key = INTERN_NONE;
+        bolt_read_key(bolt, &bolt->reader, &key);
+        if (key == BOLT_KEY_FIELDS and packstream_read_list_header(&bolt->reader, &cursor->field_count)) {
+            // Field names repeat from one query to the next, so they are interned like map keys
+            cursor->fields = (uint32_t *) pool_alloc(bolt->pool, cursor->field_count * sizeof(uint32_t));
+            for (int32_t j = 0; j < cursor->field_count; j++) {
+                int32_t field_size = 0;
+                const char *field = "";
+                packstream_read_text_view(&bolt->reader, &field_size, &field);
+                cursor->fields[j] = intern_id_bounded(bolt->strings, field, (size_t) field_size,
+                                                      MAX_INTERNED_KEYS, MAX_INTERNED_KEY_SIZE);
+                if (cursor->fields[j] != INTERN_NONE) {
+                    continue;
+                }
+                if (cursor->field_copies == NULL) {
+                    cursor->field_copies = (char **) pool_alloc(bolt->pool, cursor->field_count * sizeof(char *));
+                    memset(cursor->field_copies, 0, cursor->field_count * sizeof(char *));
+                }
+                cursor->field_copies[j] = pool_copy_text(bolt->pool, field, (size_t) field_size);
+            }
+        }
+        else {
+            packstream_skip(&bolt->reader);
+        }
+    }
+}
+
+Bolt_Cursor *bolt_cursor_create(Bolt *bolt)
+{
+    Bolt_Cursor *cursor = new Bolt_Cursor;
+    cursor->bolt = bolt;
+    cursor->state = BOLT_CURSOR_STREAMING;
+    cursor->field_count = 0;
+    cursor->fields = NULL;
+    cursor->field_copies = NULL;
+    cursor->record_size = 0;
+    cursor->value_capacity = 16;
+    cursor->value_starts = (char **) pool_alloc(bolt->pool, cursor->value_capacity * sizeof(char *));
+    cursor->indexed = 0;
+    cursor->record_count = 0;
+    cursor->summary = NULL;
+    cursor->failure_code = NULL;
+    cursor->failure_message = NULL;
+    cursor->failure_pending = false;
+    return cursor;
+}
+
+bool bolt_cursor_accept_header(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    switch (bolt->message_signature) {
+        case SUCCESS_MESSAGE:
+            bolt_cursor_read_fields(cursor);
+            return false;
+        case FAILURE_MESSAGE:
+            bolt_cursor_read_failure(cursor);
+            return true;
+        case IGNORED_MESSAGE:
+            // An earlier request in the pipeline failed
+            cursor->failure_pending = true;
+            bolt_cursor_fail(cursor, "Ignored after an earlier failure");
+            return true;
+        default:
+            bolt_cursor_fail(cursor, "Unexpected response to RUN");
+            return true;
+    }
+}
+
+bool bolt_cursor_accept(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    switch (bolt->message_signature) {
+        case RECORD_MESSAGE: {
+            if (!packstream_read_list_header(&bolt->reader, &cursor->record_size) or cursor->record_size < 0) {
+                bolt_cursor_fail(cursor, "Malformed record");
+                return false;
+            }
+            if (cursor->record_size > cursor->value_capacity) {
+                pool_free(bolt->pool, cursor->value_starts);
+                cursor->value_capacity = cursor->record_size;
+                cursor->value_starts = (char **) pool_alloc(bolt->pool, cursor->value_capacity * sizeof(char *));
+            }
+            cursor->value_starts[0] = bolt->reader;
+            cursor->indexed = cursor->record_size > 0 ? 1 : 0;
+            cursor->record_count += 1;
+            return true;
+        }
+        case SUCCESS_MESSAGE:
+            cursor->summary = bolt->reader;
+            cursor->state = BOLT_CURSOR_DONE;
+            return false;
+        case FAILURE_MESSAGE:
+            bolt_cursor_read_failure(cursor);
+            return false;
+        default:
+            cursor->failure_pending = bolt->message_signature == IGNORED_MESSAGE;
+            bolt_cursor_fail(cursor, "Unexpected response to PULL_ALL");
+            return false;
+    }
+}
+
+bool bolt_cursor_acknowledge(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    // One acknowledgement clears the failure for every request sent before it
+    if (cursor->failure_pending and bolt->acks_in_flight == 0) {
+        bolt_ack_failure(bolt);
+        return true;
+    }
+    return false;
+}
+
+void bolt_cursor_destroy(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    if (cursor->field_copies != NULL) {
+        for (int32_t i = 0; i < cursor->field_count; i++) {
+            pool_free(bolt->pool, cursor->field_copies[i]);
+        }
+        pool_free(bolt->pool, cursor->field_copies);
+    }
+    pool_free(bolt->pool, cursor->fields);
+    pool_free(bolt->pool, cursor->value_starts);
+    pool_free(bolt->pool, cursor->failure_code);
+    pool_free(bolt->pool, cursor->failure_message);
+    delete cursor;
+}
+
+Bolt_Cursor *bolt_cursor_open(Bolt *bolt)
+{
+    Bolt_Cursor *cursor = bolt_cursor_create(bolt);
+    // Acknowledgements of earlier failures may still be ahead of this result in the pipeline
+    while (bolt_next_request(bolt) == ACK_FAILURE_MESSAGE) {
+        if (!bolt_recv(bolt)) {
+            break;
+        }
+    }
+    if (!bolt_recv(bolt)) {
+        bolt_cursor_fail(cursor, "Connection failed");
+        return cursor;
+    }
+    // After a failed RUN, PULL_ALL will have been ignored
+    if (bolt_cursor_accept_header(cursor) and !bolt_recv(bolt)) {
+        cursor->failure_pending = false;
+    }
+    return cursor;
+}
+
+bool bolt_cursor_fetch(Bolt_Cursor *cursor)
+{
+    if (cursor->state != BOLT_CURSOR_STREAMING) {
+        return false;
+    }
+    if (!bolt_recv(cursor->bolt)) {
+        bolt_cursor_fail(cursor, "Connection failed");
+        return false;
+    }
+    return bolt_cursor_accept(cursor);
+}
+
+const char *bolt_cursor_field_name(Bolt_Cursor *cursor, int32_t index, size_t *size)
+{
+    if (index < 0 or index >= cursor->field_count) {
+        return NULL;
+    }
+    if (cursor->fields[index] == INTERN_NONE) {
+        const char *name = cursor->field_copies[index];
+        if (size != NULL) {
+            *size = strlen(name);
+        }
+        return name;
+    }
+    return intern_text(cursor->bolt->strings, cursor->fields[index], size);
+}
+
+char *bolt_cursor_field(Bolt_Cursor *cursor, int32_t index)
+{
+    if (index < 0 or index >= cursor->record_size) {
+        return NULL;
+    }
+    while (cursor->indexed <= index) {
+        char *value = cursor->value_starts[cursor->indexed - 1];
+        if (!packstream_skip(&value)) {
+            return NULL;
+        }
+        cursor->value_starts[cursor->indexed] = value;
+        cursor->indexed += 1;
+    }
+    return cursor->value_starts[index];
+}
+
+PackStream_Type bolt_cursor_type(Bolt_Cursor *cursor, int32_t index)
+{
+    char *value = bolt_cursor_field(cursor, index);
+    return value == NULL ? PACKSTREAM_RESERVED : packstream_next_type(value);
+}
+
+bool bolt_cursor_integer(Bolt_Cursor *cursor, int32_t index, int64_t *value)
+{
+    char *reader = bolt_cursor_field(cursor, index);
+    return reader != NULL and packstream_read_integer(&reader, value);
+}
+
+bool bolt_cursor_float(Bolt_Cursor *cursor, int32_t index, double *value)
+{
+    char *reader = bolt_cursor_field(cursor, index);
+    return reader != NULL and packstream_read_float(&reader, value);
+}
+
+bool bolt_cursor_text(Bolt_Cursor *cursor, int32_t index, int32_t *size, const char **value)
+{
+    char *reader = bolt_cursor_field(cursor, index);
+    return reader != NULL and packstream_read_text_view(&reader, size, value);
+}
+
+void bolt_cursor_close(Bolt_Cursor *cursor)
+{
+    Bolt *bolt = cursor->bolt;
+    while (bolt_cursor_fetch(cursor)) {
+    }
+    if (bolt_cursor_acknowledge(cursor)) {
+        bolt_send(bolt);
+    }
+    // Unless more results are queued behind it, take the acknowledgement now to leave the connection idle
+    while (bolt->in_flight_count > 0 and bolt->in_flight_count == bolt->acks_in_flight) {
+        if (!bolt_recv(bolt)) {
+            break;
+        }
+    }
+    bolt_cursor_destroy(cursor);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_CURSOR_H
+#define NEO4J_C_DRIVER_CURSOR_H
+
+#include "bolt.h"
+
+enum Bolt_Cursor_State {
+    BOLT_CURSOR_STREAMING = 0,
+    BOLT_CURSOR_DONE = 1,
+    BOLT_CURSOR_FAILED = 2,
+};
+
+// Reads the result of a RUN/PULL_ALL pair one record at a time. Values within a record
+// are located lazily: fields that are never asked for are skipped, never decoded.
+struct Bolt_Cursor
+{
+    Bolt *bolt;
+    Bolt_Cursor_State state;
+
+    // from the RUN summary, as names interned by the connection, or INTERN_NONE for names
+    // beyond its limits, which are copied into field_copies instead
+    int32_t field_count;
+    uint32_t *fields;
+    char **field_copies;            // NULL while every name is interned
+
+    // current record, in the read buffer until the next fetch
+    int32_t record_size;
+    char **value_starts;            // the first `indexed` entries are known
+    int32_t indexed;
+    int32_t value_capacity;
+    unsigned long record_count;
+
+    // metadata of the final SUCCESS (valid until the next bolt_recv), or details of a FAILURE
+    char *summary;
+    char *failure_code;
+    char *failure_message;
+    bool failure_pending;           // the server is ignoring requests until the failure is acknowledged
+};
+
+// Start reading a result once RUN and PULL_ALL have been sent. When several pairs have been
+// sent together, call this once for each of them in turn, closing each cursor before the next.
+Bolt_Cursor *bolt_cursor_open(Bolt *bolt);
+
+// Move to the next record, returning false at the end of the result or on failure
+bool bolt_cursor_fetch(Bolt_Cursor *cursor);
+
+// Name of a field, null-terminated; valid until another string is interned by the connection
+// or, for a name that was not interned, until the cursor is closed
+const char *bolt_cursor_field_name(Bolt_Cursor *cursor, int32_t index, size_t *size);
+
+// Position of a value in the current record, or NULL if there is no such field
+char *bolt_cursor_field(Bolt_Cursor *cursor, int32_t index);
+
+PackStream_Type bolt_cursor_type(Bolt_Cursor *cursor, int32_t index);
+
+bool bolt_cursor_integer(Bolt_Cursor *cursor, int32_t index, int64_t *value);
+
+bool bolt_cursor_float(Bolt_Cursor *cursor, int32_t index, double *value);
+
+bool bolt_cursor_text(Bolt_Cursor *cursor, int32_t index, int32_t *size, const char **value);
+
+// Discard any unread records, acknowledge a failure if there was one, and release the cursor.
+// If later results are in flight, the acknowledgement is queued behind them and consumed
+// by the next bolt_cursor_open.
+void bolt_cursor_close(Bolt_Cursor *cursor);
+
+// The steps below are shared by the blocking functions above and the asynchronous ones in
+// async.h, which differ only in how they wait for messages.
+
+Bolt_Cursor *bolt_cursor_create(Bolt *bolt);
+
+// Take in the response to RUN, returning true if the response to PULL_ALL is then only to be discarded
+bool bolt_cursor_accept_header(Bolt_Cursor *cursor);
+
+// Take in a message of the result stream, returning true if it was a record
+bool bolt_cursor_accept(Bolt_Cursor *cursor);
+
+void bolt_cursor_fail(Bolt_Cursor *cursor, const char *message);
+
+// Queue an ACK_FAILURE if one is needed, returning true if there is then something to send
+bool bolt_cursor_acknowledge(Bolt_Cursor *cursor);
+
+void bolt_cursor_destroy(Bolt_Cursor *cursor);
+
+
+#endif // NEO4J_C_DRIVER_CURSOR_H
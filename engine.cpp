@@ -0,0 +1,351 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+static const int ENGINE_INITIAL_CAPACITY = 16;
+
+Bolt_Engine *bolt_engine_create()
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("Could not create epoll instance");
+        return NULL;
+    }
+    Bolt_Engine *engine = new Bolt_Engine;
+    engine->epoll_fd = epoll_fd;
+    engine->pending = new Bolt_Engine_Connection *[ENGINE_INITIAL_CAPACITY];
+    engine->pending_count = 0;
+    engine->pending_capacity = ENGINE_INITIAL_CAPACITY;
+    engine->outstanding = 0;
+    engine->acknowledging = 0;
+    return engine;
+}
+
+void bolt_engine_destroy(Bolt_Engine *engine)
+{
+    close(engine->epoll_fd);
+    delete[] engine->pending;
+    delete engine;
+}
+
+Bolt_Engine_Connection *bolt_engine_add(Bolt_Engine *engine, Bolt *bolt)
+{
+    if (!bolt_set_nonblocking(bolt, true)) {
+        return NULL;
+    }
+    Bolt_Engine_Connection *connection = new Bolt_Engine_Connection;
+    connection->bolt = bolt;
+    connection->events = EPOLLIN;
+    connection->queued = false;
+    connection->ack_wanted = false;
+    connection->closed = false;
+    connection->requests = new Bolt_Engine_Request[ENGINE_INITIAL_CAPACITY];
+    connection->request_head = 0;
+    connection->request_count = 0;
+    connection->request_capacity = ENGINE_INITIAL_CAPACITY;
+    connection->written_count = 0;
+    struct epoll_event event;
+    event.events = connection->events;
+    event.data.ptr = connection;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, bolt->socket, &event) < 0) {
+        delete[] connection->requests;
+        delete connection;
+        return NULL;
+    }
+    return connection;
+}
+
+Bolt_Engine_Request *bolt_engine_request(Bolt_Engine_Connection *connection, int index)
+{
+    return &connection->requests[(connection->request_head + index) % connection->request_capacity];
+}
+
+void bolt_engine_finish(Bolt_Engine *engine, Bolt_Engine_Request *request, Bolt *bolt, Bolt_Result_Status status,
+                        char *metadata, int *completed)
+{
+    request->finished = true;
+    engine->outstanding -= 1;
+    *completed += 1;
+    request->handler.done(request->handler.data, bolt, status, metadata);
+}
+
+void bolt_engine_pop(Bolt_Engine_Connection *connection)
+{
+    connection->request_head = (connection->request_head + 1) % connection->request_capacity;
+    connection->request_count -= 1;
+    connection->written_count -= 1;
+}
+
+// Report every unfinished request as defunct and stop watching the socket
+void bolt_engine_fail(Bolt_Engine *engine, Bolt_Engine_Connection *connection, int *completed)
+{
+    connection->closed = true;
+    connection->ack_wanted = false;
+    connection->bolt->defunct = true;
+    engine->acknowledging -= connection->bolt->acks_in_flight;
+    epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, connection->bolt->socket, NULL);
+    for (int i = 0; i < connection->request_count; i++) {
+        Bolt_Engine_Request *request = bolt_engine_request(connection, i);
+        if (!request->finished) {
+            bolt_engine_finish(engine, request, connection->bolt, BOLT_RESULT_DEFUNCT, NULL, completed);
+        }
+    }
+    connection->request_count = 0;
+    connection->written_count = 0;
+}
+
+Bolt *bolt_engine_remove(Bolt_Engine *engine, Bolt_Engine_Connection *connection)
+{
+    Bolt *bolt = connection->bolt;
+    if (!connection->closed) {
+        int completed = 0;
+        if (connection->request_count > 0) {
+            bolt_engine_fail(engine, connection, &completed);
+        }
+        else {
+            epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, bolt->socket, NULL);
+        }
+    }
+    for (int i = 0; i < engine->pending_count; i++) {
+        if (engine->pending[i] == connection) {
+            engine->pending[i] = engine->pending[--engine->pending_count];
+            break;
+        }
+    }
+    delete[] connection->requests;
+    delete connection;
+    bolt_set_nonblocking(bolt, false);
+    return bolt;
+}
+
+void bolt_engine_queue(Bolt_Engine *engine, Bolt_Engine_Connection *connection)
+{
+    if (connection->queued) {
+        return;
+    }
+    if (engine->pending_count == engine->pending_capacity) {
+        Bolt_Engine_Connection **pending = new Bolt_Engine_Connection *[engine->pending_capacity * 2];
+        memcpy(pending, engine->pending, engine->pending_count * sizeof(Bolt_Engine_Connection *));
+        delete[] engine->pending;
+        engine->pending = pending;
+        engine->pending_capacity *= 2;
+    }
+    engine->pending[engine->pending_count++] = connection;
+    connection->queued = true;
+}
+
+void bolt_engine_submit(Bolt_Engine *engine, Bolt_Engine_Connection *connection, const char *statement,
+                        size_t parameter_count, PackStream_Pair *parameters, const Bolt_Handler *handler)
+{
+    engine->outstanding += 1;
+    if (connection->closed) {
+        int completed = 0;
+        Bolt_Engine_Request request;
+        request.handler = *handler;
+        bolt_engine_finish(engine, &request, connection->bolt, BOLT_RESULT_DEFUNCT, NULL, &completed);
+        return;
+    }
+    if (connection->request_count == connection->request_capacity) {
+        Bolt_Engine_Request *requests = new Bolt_Engine_Request[connection->request_capacity * 2];
+        for (int i = 0; i < connection->request_count; i++) {
+            requests[i] = *bolt_engine_request(connection, i);
+        }
+        delete[] connection->requests;
+        connection->requests = requests;
+        connection->request_head = 0;
+        connection->request_capacity *= 2;
+    }
+    Bolt_Engine_Request *request = bolt_engine_request(connection, connection->request_count);
+    request->handler = *handler;
+    request->statement = statement;
+    request->parameter_count = parameter_count;
+    request->parameters = parameters;
+    request->finished = false;
+    connection->request_count += 1;
+    bolt_engine_queue(engine, connection);
+}
+
+// Write whatever is waiting and send as much as the socket takes, watching for writability
+// only while a send is incomplete
+void bolt_engine_write(Bolt_Engine *engine, Bolt_Engine_Connection *connection, int *completed)
+{
+    Bolt *bolt = connection->bolt;
+    for (;;) {
+        if (!bolt_sending(bolt)) {
+            // A failure is acknowledged before later requests, which would otherwise be ignored
+            if (connection->ack_wanted) {
+                bolt_ack_failure(bolt);
+                connection->ack_wanted = false;
+                engine->acknowledging += 1;
+            }
+            for (int i = connection->written_count; i < connection->request_count; i++) {
+                Bolt_Engine_Request *request = bolt_engine_request(connection, i);
+                bolt_run(bolt, request->statement, request->parameter_count, request->parameters);
+                bolt_pull_all(bolt);
+            }
+            connection->written_count = connection->request_count;
+        }
+        if (!bolt_flush(bolt)) {
+            bolt_engine_fail(engine, connection, completed);
+            return;
+        }
+        if (bolt_sending(bolt) or (!connection->ack_wanted and connection->written_count == connection->request_count)) {
+            break;
+        }
+    }
+    uint32_t events = bolt_sending(bolt) ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    if (events != connection->events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = connection;
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, bolt->socket, &event);
+        connection->events = events;
+    }
+}
+
+Bolt_Result_Status bolt_engine_status(char signature)
+{
+    switch (signature) {
+        case SUCCESS_MESSAGE:
+            return BOLT_RESULT_SUCCESS;
+        case IGNORED_MESSAGE:
+            return BOLT_RESULT_IGNORED;
+        default:
+            return BOLT_RESULT_FAILURE;
+    }
+}
+
+// Hand a complete message to the request it belongs to
+void bolt_engine_dispatch(Bolt_Engine *engine, Bolt_Engine_Connection *connection, int *completed)
+{
+    Bolt *bolt = connection->bolt;
+    Bolt_Engine_Request *request = connection->request_count > 0 ? bolt_engine_request(connection, 0) : NULL;
+    char *metadata = bolt->message_signature == IGNORED_MESSAGE ? NULL : bolt->reader;
+    if (bolt->message_signature == RECORD_MESSAGE) {
+        int32_t size;
+        if (request != NULL and !request->finished and request->handler.record != NULL and
+            packstream_read_list_header(&bolt->reader, &size)) {
+            request->handler.record(request->handler.data, bolt, bolt->reader, size);
+        }
+        return;
+    }
+    if (bolt->message_signature == FAILURE_MESSAGE and bolt->acks_in_flight == 0) {
+        connection->ack_wanted = true;
+        bolt_engine_queue(engine, connection);
+    }
+    if (request == NULL and bolt->message_request != ACK_FAILURE_MESSAGE) {
+        return;
+    }
+    switch (bolt->message_request) {
+        case RUN_MESSAGE:
+            if (bolt->message_signature == SUCCESS_MESSAGE) {
+                if (request->handler.header != NULL) {
+                    request->handler.header(request->handler.data, bolt, metadata);
+                }
+            }
+            else if (!request->finished) {
+                // PULL_ALL will be ignored
+                bolt_engine_finish(engine, request, bolt, bolt_engine_status(bolt->message_signature), metadata,
+                                   completed);
+            }
+            break;
+        case PULL_ALL_MESSAGE:
+            if (!request->finished) {
+                bolt_engine_finish(engine, request, bolt, bolt_engine_status(bolt->message_signature), metadata,
+                                   completed);
+            }
+            bolt_engine_pop(connection);
+            break;
+        case ACK_FAILURE_MESSAGE:
+            engine->acknowledging -= 1;
+            break;
+        default:
+            break;
+    }
+}
+
+// Parse and dispatch every message that can be completed from what the socket has
+void bolt_engine_read(Bolt_Engine *engine, Bolt_Engine_Connection *connection, int *completed)
+{
+    Bolt *bolt = connection->bolt;
+    for (;;) {
+        int parsed = bolt_parse(bolt);
+        if (parsed > 0) {
+            bolt_engine_dispatch(engine, connection, completed);
+            continue;
+        }
+        if (parsed < 0) {
+            bolt_engine_fail(engine, connection, completed);
+            return;
+        }
+        ssize_t received = bolt_fill(bolt);
+        if (received > 0) {
+            continue;
+        }
+        if (received < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+            return;
+        }
+        bolt_engine_fail(engine, connection, completed);
+        return;
+    }
+}
+
+int bolt_engine_poll(Bolt_Engine *engine, int timeout)
+{
+    int completed = 0;
+    for (int i = 0; i < engine->pending_count; i++) {
+        Bolt_Engine_Connection *connection = engine->pending[i];
+        connection->queued = false;
+        if (!connection->closed) {
+            bolt_engine_write(engine, connection, &completed);
+        }
+    }
+    engine->pending_count = 0;
+
+    struct epoll_event events[ENGINE_MAX_EVENTS];
+    int count = epoll_wait(engine->epoll_fd, events, ENGINE_MAX_EVENTS, timeout);
+    if (count < 0) {
+        return errno == EINTR ? completed : -1;
+    }
+    for (int i = 0; i < count; i++) {
+        Bolt_Engine_Connection *connection = (Bolt_Engine_Connection *) events[i].data.ptr;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            bolt_engine_read(engine, connection, &completed);
+        }
+        if ((events[i].events & EPOLLOUT) and !connection->closed) {
+            bolt_engine_write(engine, connection, &completed);
+        }
+    }
+    return completed;
+}
+
+bool bolt_engine_run(Bolt_Engine *engine)
+{
+    while (engine->outstanding > 0 or engine->acknowledging > 0 or engine->pending_count > 0) {
+        // Only block when a response is due; a pending connection may have nothing left to send
+        int timeout = engine->outstanding > 0 or engine->acknowledging > 0 ? -1 : 0;
+        if (bolt_engine_poll(engine, timeout) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_ENGINE_H
+#define NEO4J_C_DRIVER_ENGINE_H
+
+#include "bolt.h"
+
+static const int ENGINE_MAX_EVENTS = 256;
+
+enum Bolt_Result_Status {
+    BOLT_RESULT_SUCCESS = 0,
+    BOLT_RESULT_FAILURE = 1,
+    BOLT_RESULT_IGNORED = 2,        // an earlier request on the connection failed
+    BOLT_RESULT_DEFUNCT = 3,        // the connection failed before the result was complete
+};
+
+// Callbacks for one result, called from bolt_engine_poll. Pointers into the read buffer are
+// only valid for the duration of the call. Any callback except done may be NULL.
+struct Bolt_Handler
+{
+    // metadata map of the RUN summary, which holds the field names
+    void (*header)(void *data, Bolt *bolt, char *metadata);
+
+    // values of one record, positioned after the list header
+    void (*record)(void *data, Bolt *bolt, char *values, int32_t size);
+
+    // metadata of the final SUCCESS or FAILURE, or NULL if there is none
+    void (*done)(void *data, Bolt *bolt, Bolt_Result_Status status, char *metadata);
+
+    void *data;
+};
+
+struct Bolt_Engine_Request
+{
+    Bolt_Handler handler;
+    const char *statement;
+    size_t parameter_count;
+    PackStream_Pair *parameters;
+    bool finished;                  // done has been called, so later responses are only consumed
+};
+
+// A connection driven by an engine. Requests are kept oldest first, those already written
+// ahead of the rest; the others wait until no partial send is in progress, as the queued
+// segments cannot be rearranged while they are being sent.
+struct Bolt_Engine_Connection
+{
+    Bolt *bolt;
+    uint32_t events;                // currently registered with epoll
+    bool queued;                    // in the engine's list of connections with requests to send
+    bool ack_wanted;
+    bool closed;
+    Bolt_Engine_Request *requests;
+    int request_head;
+    int request_count;
+    int request_capacity;
+    int written_count;
+};
+
+// Drives many non-blocking connections from one thread, using epoll
+struct Bolt_Engine
+{
+    int epoll_fd;
+    Bolt_Engine_Connection **pending;   // connections with requests to write
+    int pending_count;
+    int pending_capacity;
+    unsigned long outstanding;          // requests submitted whose done callback has not run
+    unsigned long acknowledging;        // failure acknowledgements sent but not yet answered
+};
+
+Bolt_Engine *bolt_engine_create();
+
+// Connections must have been removed first
+void bolt_engine_destroy(Bolt_Engine *engine);
+
+// Take over a connection that has completed INIT, switching it to non-blocking mode
+Bolt_Engine_Connection *bolt_engine_add(Bolt_Engine *engine, Bolt *bolt);
+
+// Stop driving a connection and return it to blocking mode. Requests still outstanding are
+// reported as defunct, and so is the connection. Not to be called from a callback.
+Bolt *bolt_engine_remove(Bolt_Engine *engine, Bolt_Engine_Connection *connection);
+
+// Queue a RUN/PULL_ALL pair. Nothing is sent until the next bolt_engine_poll, so requests
+// submitted together go out together. The statement and parameters must stay valid until done.
+void bolt_engine_submit(Bolt_Engine *engine, Bolt_Engine_Connection *connection, const char *statement,
+                        size_t parameter_count, PackStream_Pair *parameters, const Bolt_Handler *handler);
+
+// Send what has been submitted, wait up to timeout milliseconds (-1 for ever) for connections
+// to become ready, and handle what arrives. Returns the number of results completed, or -1.
+int bolt_engine_poll(Bolt_Engine *engine, int timeout);
+
+// Poll until every submitted request has completed and every failure has been acknowledged
+bool bolt_engine_run(Bolt_Engine *engine);
+
+
+#endif // NEO4J_C_DRIVER_ENGINE_H
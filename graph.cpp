@@ -0,0 +1,435 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "bolt.h"
+#include "graph.h"
+
+static const uint32_t GRAPH_INITIAL_CAPACITY = 64;
+
+template <typename T>
+void graph_reserve(T **array, uint32_t *capacity, uint32_t count, uint32_t needed)
+{
+    if (needed <= *capacity) {
+        return;
+    }
+    uint32_t new_capacity = *capacity == 0 ? GRAPH_INITIAL_CAPACITY : *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    T *resized = new T[new_capacity];
+    if (*array != NULL) {
+        memcpy(resized, *array, count * sizeof(T));
+        delete[] *array;
+    }
+    *array = resized;
+    *capacity = new_capacity;
+}
+
+void graph_index_init(Graph_Id_Index *index)
+{
+    index->slot_count = GRAPH_INITIAL_CAPACITY * 2;
+    index->keys = new int64_t[index->slot_count];
+    index->values = new uint32_t[index->slot_count]();
+    index->count = 0;
+}
+
+void graph_index_destroy(Graph_Id_Index *index)
+{
+    delete[] index->keys;
+    delete[] index->values;
+}
+
+void graph_index_clear(Graph_Id_Index *index)
+{
+    memset(index->values, 0, index->slot_count * sizeof(uint32_t));
+    index->count = 0;
+}
+
+uint32_t graph_index_slot(const Graph_Id_Index *index, int64_t id)
+{
+    uint32_t mask = index->slot_count - 1;
+    uint32_t slot = (uint32_t) (((uint64_t) id * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    while (index->values[slot] != 0 and index->keys[slot] != id) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Index of the entity with this identity, or -1
+int64_t graph_index_find(const Graph_Id_Index *index, int64_t id)
+{
+    uint32_t slot = graph_index_slot(index, id);
+    return index->values[slot] == 0 ? -1 : (int64_t) index->values[slot] - 1;
+}
+
+void graph_index_add(Graph_Id_Index *index, int64_t id, uint32_t value)
+{
+    if ((index->count + 1) * 2 > index->slot_count) {
+        int64_t *keys = index->keys;
+        uint32_t *values = index->values;
+        uint32_t slot_count = index->slot_count;
+        index->slot_count *= 2;
+        index->keys = new int64_t[index->slot_count];
+        index->values = new uint32_t[index->slot_count]();
+        for (uint32_t i = 0; i < slot_count; i++) {
+            if (values[i] != 0) {
+                uint32_t slot = graph_index_slot(index, keys[i]);
+                index->keys[slot] = keys[i];
+                index->values[slot] = values[i];
+            }
+        }
+        delete[] keys;
+        delete[] values;
+    }
+    uint32_t slot = graph_index_slot(index, id);
+    index->keys[slot] = id;
+    index->values[slot] = value + 1;
+    index->count += 1;
+}
+
+Graph_Store *graph_create(Intern_Table *strings)
+{
+    Graph_Store *store = new Graph_Store;
+    memset(store, 0, sizeof(Graph_Store));
+    store->owns_strings = strings == NULL;
+    store->strings = strings == NULL ? intern_create() : strings;
+    store->local_strings = intern_create();
+    graph_index_init(&store->node_index);
+    graph_index_init(&store->relationship_index);
+    return store;
+}
+
+void graph_destroy(Graph_Store *store)
+{
+    if (store->owns_strings) {
+        intern_destroy(store->strings);
+    }
+    intern_destroy(store->local_strings);
+    delete[] store->nodes;
+    delete[] store->relationships;
+    delete[] store->paths;
+    delete[] store->labels;
+    delete[] store->properties;
+    delete[] store->path_entries;
+    delete[] store->scratch;
+    delete[] store->data;
+    graph_index_destroy(&store->node_index);
+    graph_index_destroy(&store->relationship_index);
+    delete store;
+}
+
+void graph_clear(Graph_Store *store)
+{
+    store->node_count = 0;
+    store->relationship_count = 0;
+    store->path_count = 0;
+    store->label_count = 0;
+    store->property_count = 0;
+    store->path_entry_count = 0;
+    store->data_size = 0;
+    if (store->local_strings->count > 0) {
+        intern_destroy(store->local_strings);
+        store->local_strings = intern_create();
+    }
+    graph_index_clear(&store->node_index);
+    graph_index_clear(&store->relationship_index);
+}
+
+uint64_t graph_copy_data(Graph_Store *store, const char *data, size_t size)
+{
+    if (store->data_size + size > store->data_capacity) {
+        size_t capacity = store->data_capacity == 0 ? 1024 : store->data_capacity;
+        while (store->data_size + size > capacity) {
+            capacity *= 2;
+        }
+        char *resized = new char[capacity];
+        if (store->data != NULL) {
+            memcpy(resized, store->data, store->data_size);
+            delete[] store->data;
+        }
+        store->data = resized;
+        store->data_capacity = capacity;
+    }
+    uint64_t offset = store->data_size;
+    memcpy(store->data + offset, data, size);
+    store->data_size += size;
+    return offset;
+}
+
+uint32_t graph_intern(Graph_Store *store, const char *text, size_t size)
+{
+    uint32_t id = intern_id_bounded(store->strings, text, size, MAX_INTERNED_KEYS, MAX_INTERNED_KEY_SIZE);
+    if (id != INTERN_NONE) {
+        return id;
+    }
+    return intern_id(store->local_strings, text, size) | GRAPH_LOCAL_STRING;
+}
+
+bool graph_read_property(Graph_Store *store, char **buffer, Graph_Property *property)
+{
+    int32_t key_size;
+    const char *key;
+    if (!packstream_read_text_view(buffer, &key_size, &key)) {
+        return false;
+    }
+    property->key = graph_intern(store, key, (size_t) key_size);
+    property->type = (signed char) packstream_next_type(*buffer);
+    property->size = 0;
+    switch (property->type) {
+        case PACKSTREAM_NULL:
+            property->integer = 0;
+            return packstream_read_null(buffer);
+        case PACKSTREAM_BOOLEAN:
+            return packstream_read_boolean(buffer, &property->boolean);
+        case PACKSTREAM_INTEGER:
+            return packstream_read_integer(buffer, &property->integer);
+        case PACKSTREAM_FLOAT:
+            return packstream_read_float(buffer, &property->number);
+        case PACKSTREAM_TEXT:
+        case PACKSTREAM_BYTES: {
+            int32_t size;
+            const char *value;
+            bool read = property->type == PACKSTREAM_TEXT ? packstream_read_text_view(buffer, &size, &value)
+                                                          : packstream_read_bytes_view(buffer, &size, &value);
+            if (!read) {
+                return false;
+            }
+            property->size = (uint32_t) size;
+            property->offset = graph_copy_data(store, value, (size_t) size);
+            return true;
+        }
+        default: {
+            // Lists and maps are kept in their encoded form, to be decoded if and when needed
+            char *start = *buffer;
+            if (!packstream_skip(buffer)) {
+                return false;
+            }
+            property->size = (uint32_t) (*buffer - start);
+            property->offset = graph_copy_data(store, start, property->size);
+            return true;
+        }
+    }
+}
+
+bool graph_read_properties(Graph_Store *store, char **buffer, uint32_t *first, uint32_t *count)
+{
+    int32_t size;
+    if (!packstream_read_map_header(buffer, &size) or size < 0) {
+        return false;
+    }
+    graph_reserve(&store->properties, &store->property_capacity, store->property_count, store->property_count + size);
+    *first = store->property_count;
+    *count = (uint32_t) size;
+    size_t data_size = store->data_size;
+    for (int32_t i = 0; i < size; i++) {
+        if (!graph_read_property(store, buffer, &store->properties[store->property_count])) {
+            // Drop the properties already read, as no entity will own them
+            store->property_count = *first;
+            store->data_size = data_size;
+            return false;
+        }
+        store->property_count += 1;
+    }
+    return true;
+}
+
+bool graph_read_node(Graph_Store *store, char **buffer, uint32_t *index)
+{
+    int32_t size;
+    char signature;
+    int64_t id;
+    if (!packstream_read_structure_header(buffer, &size, &signature) or signature != NEO4J_NODE or size != 3 or
+        !packstream_read_integer(buffer, &id)) {
+        return false;
+    }
+    int64_t existing = graph_index_find(&store->node_index, id);
+    if (existing >= 0) {
+        *index = (uint32_t) existing;
+        return packstream_skip(buffer) and packstream_skip(buffer);
+    }
+
+    Graph_Node node;
+    node.id = id;
+    int32_t label_count;
+    if (!packstream_read_list_header(buffer, &label_count) or label_count < 0) {
+        return false;
+    }
+    graph_reserve(&store->labels, &store->label_capacity, store->label_count, store->label_count + label_count);
+    node.first_label = store->label_count;
+    node.label_count = (uint32_t) label_count;
+    for (int32_t i = 0; i < label_count; i++) {
+        int32_t label_size;
+        const char *label;
+        if (!packstream_read_text_view(buffer, &label_size, &label)) {
+            store->label_count = node.first_label;
+            return false;
+        }
+        store->labels[store->label_count++] = graph_intern(store, label, (size_t) label_size);
+    }
+    if (!graph_read_properties(store, buffer, &node.first_property, &node.property_count)) {
+        store->label_count = node.first_label;
+        return false;
+    }
+
+    graph_reserve(&store->nodes, &store->node_capacity, store->node_count, store->node_count + 1);
+    *index = store->node_count;
+    store->nodes[store->node_count++] = node;
+    graph_index_add(&store->node_index, id, *index);
+    return true;
+}
+
+bool graph_read_relationship(Graph_Store *store, char **buffer, uint32_t *index)
+{
+    int32_t size;
+    char signature;
+    int64_t id;
+    if (!packstream_read_structure_header(buffer, &size, &signature) or !packstream_read_integer(buffer, &id)) {
+        return false;
+    }
+    bool bound = signature == NEO4J_RELATIONSHIP and size == 5;
+    if (!bound and (signature != NEO4J_UNBOUND_RELATIONSHIP or size != 3)) {
+        return false;
+    }
+    Graph_Relationship relationship;
+    relationship.id = id;
+    relationship.start = -1;
+    relationship.end = -1;
+    if (bound and (!packstream_read_integer(buffer, &relationship.start) or
+                   !packstream_read_integer(buffer, &relationship.end))) {
+        return false;
+    }
+
+    int64_t existing = graph_index_find(&store->relationship_index, id);
+    if (existing >= 0) {
+        *index = (uint32_t) existing;
+        Graph_Relationship *stored = &store->relationships[existing];
+        if (bound and stored->start < 0) {
+            stored->start = relationship.start;
+            stored->end = relationship.end;
+        }
+        return packstream_skip(buffer) and packstream_skip(buffer);
+    }
+
+    int32_t type_size;
+    const char *type;
+    if (!packstream_read_text_view(buffer, &type_size, &type)) {
+        return false;
+    }
+    relationship.type = graph_intern(store, type, (size_t) type_size);
+    if (!graph_read_properties(store, buffer, &relationship.first_property, &relationship.property_count)) {
+        return false;
+    }
+
+    graph_reserve(&store->relationships, &store->relationship_capacity, store->relationship_count,
+                  store->relationship_count + 1);
+    *index = store->relationship_count;
+    store->relationships[store->relationship_count++] = relationship;
+    graph_index_add(&store->relationship_index, id, *index);
+    return true;
+}
+
+bool graph_read_path(Graph_Store *store, char **buffer, uint32_t *index)
+{
+    int32_t size;
+    char signature;
+    if (!packstream_read_structure_header(buffer, &size, &signature) or signature != NEO4J_PATH or size != 3) {
+        return false;
+    }
+
+    // Distinct nodes then distinct relationships go into scratch as store indices
+    int32_t node_count;
+    if (!packstream_read_list_header(buffer, &node_count) or node_count <= 0) {
+        return false;
+    }
+    graph_reserve(&store->scratch, &store->scratch_capacity, 0, (uint32_t) node_count);
+    for (int32_t i = 0; i < node_count; i++) {
+        if (!graph_read_node(store, buffer, &store->scratch[i])) {
+            return false;
+        }
+    }
+    int32_t relationship_count;
+    if (!packstream_read_list_header(buffer, &relationship_count) or relationship_count < 0) {
+        return false;
+    }
+    graph_reserve(&store->scratch, &store->scratch_capacity, (uint32_t) node_count,
+                  (uint32_t) (node_count + relationship_count));
+    uint32_t *nodes = store->scratch;
+    uint32_t *relationships = store->scratch + node_count;
+    for (int32_t i = 0; i < relationship_count; i++) {
+        if (!graph_read_relationship(store, buffer, &relationships[i])) {
+            return false;
+        }
+    }
+
+    // The sequence alternates a relationship number (1-based, negative if traversed
+    // backwards) with the index of the node reached
+    int32_t sequence_size;
+    if (!packstream_read_list_header(buffer, &sequence_size) or sequence_size < 0 or sequence_size % 2 != 0) {
+        return false;
+    }
+    graph_reserve(&store->path_entries, &store->path_entry_capacity, store->path_entry_count,
+                  store->path_entry_count + sequence_size + 1);
+    Graph_Path path;
+    path.first_entry = store->path_entry_count;
+    path.length = (uint32_t) (sequence_size / 2);
+    uint32_t previous = nodes[0];
+    store->path_entries[store->path_entry_count++] = previous;
+    for (int32_t i = 0; i < sequence_size; i += 2) {
+        int64_t relationship_number;
+        int64_t node_number;
+        if (!packstream_read_integer(buffer, &relationship_number) or !packstream_read_integer(buffer, &node_number)) {
+            store->path_entry_count = path.first_entry;
+            return false;
+        }
+        int64_t relationship_offset = relationship_number > 0 ? relationship_number - 1 : -relationship_number - 1;
+        if (relationship_number == 0 or relationship_offset >= relationship_count or
+            node_number < 0 or node_number >= node_count) {
+            store->path_entry_count = path.first_entry;
+            return false;
+        }
+        uint32_t next = nodes[node_number];
+        Graph_Relationship *relationship = &store->relationships[relationships[relationship_offset]];
+        if (relationship->start < 0) {
+            int64_t previous_id = store->nodes[previous].id;
+            int64_t next_id = store->nodes[next].id;
+            relationship->start = relationship_number > 0 ? previous_id : next_id;
+            relationship->end = relationship_number > 0 ? next_id : previous_id;
+        }
+        store->path_entries[store->path_entry_count++] = relationships[relationship_offset];
+        store->path_entries[store->path_entry_count++] = next;
+        previous = next;
+    }
+
+    graph_reserve(&store->paths, &store->path_capacity, store->path_count, store->path_count + 1);
+    *index = store->path_count;
+    store->paths[store->path_count++] = path;
+    return true;
+}
+
+const char *graph_property_data(const Graph_Store *store, const Graph_Property *property)
+{
+    return store->data + property->offset;
+}
+
+const char *graph_text(const Graph_Store *store, uint32_t id, size_t *size)
+{
+    if ((id & GRAPH_LOCAL_STRING) != 0) {
+        return intern_text(store->local_strings, id & ~GRAPH_LOCAL_STRING, size);
+    }
+    return intern_text(store->strings, id, size);
+}
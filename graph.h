@@ -0,0 +1,140 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEO4J_C_DRIVER_GRAPH_H
+#define NEO4J_C_DRIVER_GRAPH_H
+
+#include "intern.h"
+#include "packstream.h"
+
+// Set in the ID of a string interned by the store itself rather than in the shared table
+static const uint32_t GRAPH_LOCAL_STRING = 0x80000000;
+
+struct Graph_Property
+{
+    uint32_t key;               // interned
+    uint32_t size;              // bytes of text or byte data, or of the raw encoding of a list or map
+    signed char type;           // PackStream_Type
+    union {
+        bool boolean;
+        int64_t integer;
+        double number;
+        uint64_t offset;        // start of the text, bytes or raw encoding in Graph_Store::data
+    };
+};
+
+struct Graph_Node
+{
+    int64_t id;
+    uint32_t first_label;       // into Graph_Store::labels
+    uint32_t label_count;
+    uint32_t first_property;    // into Graph_Store::properties
+    uint32_t property_count;
+};
+
+struct Graph_Relationship
+{
+    int64_t id;
+    int64_t start;              // node identities, or -1 until known
+    int64_t end;
+    uint32_t type;              // interned
+    uint32_t first_property;
+    uint32_t property_count;
+};
+
+// Entries alternate node, relationship, node... as indices into the store's shared node and
+// relationship arrays, so a path of length n occupies 2n + 1 entries from first_entry
+struct Graph_Path
+{
+    uint32_t first_entry;
+    uint32_t length;
+};
+
+// Open-addressed map from entity identity to its index in the store
+struct Graph_Id_Index
+{
+    int64_t *keys;
+    uint32_t *values;           // index + 1, or 0 when the slot is empty
+    uint32_t slot_count;
+    uint32_t count;
+};
+
+// Decoded nodes, relationships and paths in flat arrays. Each entity is stored once however
+// often it is returned, and labels, types and property keys are interned: in the shared table
+// while it is within the connection's limits, otherwise in a local table emptied by graph_clear.
+struct Graph_Store
+{
+    Intern_Table *strings;
+    bool owns_strings;
+    Intern_Table *local_strings;
+
+    Graph_Node *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    Graph_Relationship *relationships;
+    uint32_t relationship_count;
+    uint32_t relationship_capacity;
+
+    Graph_Path *paths;
+    uint32_t path_count;
+    uint32_t path_capacity;
+
+    uint32_t *labels;
+    uint32_t label_count;
+    uint32_t label_capacity;
+
+    Graph_Property *properties;
+    uint32_t property_count;
+    uint32_t property_capacity;
+
+    uint32_t *path_entries;
+    uint32_t path_entry_count;
+    uint32_t path_entry_capacity;
+
+    uint32_t *scratch;
+    uint32_t scratch_capacity;
+
+    char *data;
+    size_t data_size;
+    size_t data_capacity;
+
+    Graph_Id_Index node_index;
+    Graph_Id_Index relationship_index;
+};
+
+// Create a store, interning into the given table or, if there is none, a table of its own
+Graph_Store *graph_create(Intern_Table *strings);
+
+void graph_destroy(Graph_Store *store);
+
+// Forget every entity while keeping the memory (and interned strings) for reuse
+void graph_clear(Graph_Store *store);
+
+bool graph_read_node(Graph_Store *store, char **buffer, uint32_t *index);
+
+// Reads either a Relationship or an UnboundRelationship
+bool graph_read_relationship(Graph_Store *store, char **buffer, uint32_t *index);
+
+bool graph_read_path(Graph_Store *store, char **buffer, uint32_t *index);
+
+const char *graph_property_data(const Graph_Store *store, const Graph_Property *property);
+
+// Text of an interned label, type or property key, null-terminated
+const char *graph_text(const Graph_Store *store, uint32_t id, size_t *size);
+
+
+#endif // NEO4J_C_DRIVER_GRAPH_H
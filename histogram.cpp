@@ -0,0 +1,179 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+
+#include "histogram.h"
+
+static int bucket_index_of(const Histogram *histogram, int64_t value)
+{
+    // Position of the highest set bit, counting a value below the first bucket's top as that bucket
+    int pow2_ceiling = 64 - __builtin_clzll((uint64_t) (value | histogram->sub_bucket_mask));
+    return pow2_ceiling - (histogram->sub_bucket_half_count_magnitude + 1);
+}
+
+static int counts_index_of(const Histogram *histogram, int64_t value)
+{
+    int bucket_index = bucket_index_of(histogram, value);
+    int sub_bucket_index = (int) (value >> bucket_index);
+    // Every bucket after the first only uses the upper half of its sub-buckets
+    return ((bucket_index + 1) << histogram->sub_bucket_half_count_magnitude) + sub_bucket_index -
+           (int) histogram->sub_bucket_half_count;
+}
+
+static int64_t lowest_value_at(const Histogram *histogram, int index)
+{
+    int bucket_index = (index >> histogram->sub_bucket_half_count_magnitude) - 1;
+    int64_t sub_bucket_index = (index & (histogram->sub_bucket_half_count - 1)) + histogram->sub_bucket_half_count;
+    if (bucket_index < 0) {
+        sub_bucket_index -= histogram->sub_bucket_half_count;
+        bucket_index = 0;
+    }
+    return sub_bucket_index << bucket_index;
+}
+
+static int64_t highest_value_at(const Histogram *histogram, int index)
+{
+    int64_t lowest = lowest_value_at(histogram, index);
+    return lowest + (((int64_t) 1) << bucket_index_of(histogram, lowest)) - 1;
+}
+
+Histogram *histogram_create(int64_t highest_value, int significant_digits)
+{
+    if (highest_value < 2 or significant_digits < 1 or significant_digits > 5) {
+        return NULL;
+    }
+    Histogram *histogram = new Histogram;
+    histogram->highest_value = highest_value;
+    histogram->significant_digits = significant_digits;
+
+    int64_t largest_single_unit = 2 * (int64_t) pow(10, significant_digits);
+    int sub_bucket_count_magnitude = (int) ceil(log2((double) largest_single_unit));
+    histogram->sub_bucket_half_count_magnitude = sub_bucket_count_magnitude - 1;
+    int64_t sub_bucket_count = ((int64_t) 1) << sub_bucket_count_magnitude;
+    histogram->sub_bucket_half_count = sub_bucket_count / 2;
+    histogram->sub_bucket_mask = sub_bucket_count - 1;
+
+    int64_t smallest_untrackable = sub_bucket_count;
+    int bucket_count = 1;
+    while (smallest_untrackable <= highest_value) {
+        smallest_untrackable <<= 1;
+        bucket_count += 1;
+    }
+    histogram->bucket_count = bucket_count;
+    histogram->counts_length = (bucket_count + 1) * (int) histogram->sub_bucket_half_count;
+    histogram->counts = new uint64_t[histogram->counts_length];
+    histogram_reset(histogram);
+    return histogram;
+}
+
+void histogram_destroy(Histogram *histogram)
+{
+    delete[] histogram->counts;
+    delete histogram;
+}
+
+void histogram_reset(Histogram *histogram)
+{
+    for (int i = 0; i < histogram->counts_length; i++) {
+        histogram->counts[i] = 0;
+    }
+    histogram->total_count = 0;
+    histogram->total_sum = 0;
+    histogram->min_value = INT64_MAX;
+    histogram->max_value = 0;
+}
+
+void histogram_record(Histogram *histogram, int64_t value)
+{
+    if (value < 0) {
+        value = 0;
+    }
+    else if (value > histogram->highest_value) {
+        value = histogram->highest_value;
+    }
+    histogram->counts[counts_index_of(histogram, value)] += 1;
+    histogram->total_count += 1;
+    histogram->total_sum += value;
+    if (value < histogram->min_value) {
+        histogram->min_value = value;
+    }
+    if (value > histogram->max_value) {
+        histogram->max_value = value;
+    }
+}
+
+bool histogram_merge(Histogram *target, const Histogram *source)
+{
+    if (target->counts_length != source->counts_length or
+        target->sub_bucket_half_count != source->sub_bucket_half_count) {
+        return false;
+    }
+    for (int i = 0; i < source->counts_length; i++) {
+        target->counts[i] += source->counts[i];
+    }
+    target->total_count += source->total_count;
+    target->total_sum += source->total_sum;
+    if (source->min_value < target->min_value) {
+        target->min_value = source->min_value;
+    }
+    if (source->max_value > target->max_value) {
+        target->max_value = source->max_value;
+    }
+    return true;
+}
+
+int64_t histogram_value_at_percentile(const Histogram *histogram, double percentile)
+{
+    if (histogram->total_count == 0) {
+        return 0;
+    }
+    if (percentile <= 0.0) {
+        return histogram->min_value;
+    }
+    if (percentile > 100.0) {
+        percentile = 100.0;
+    }
+    uint64_t count_at_percentile = (uint64_t) (percentile / 100.0 * histogram->total_count + 0.5);
+    if (count_at_percentile == 0) {
+        count_at_percentile = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < histogram->counts_length; i++) {
+        seen += histogram->counts[i];
+        if (seen >= count_at_percentile) {
+            // The top of a sub-bucket can overshoot what was actually recorded
+            int64_t value = highest_value_at(histogram, i);
+            return value < histogram->max_value ? value : histogram->max_value;
+        }
+    }
+    return histogram->max_value;
+}
+
+double histogram_mean(const Histogram *histogram)
+{
+    return histogram->total_count == 0 ? 0.0 : (double) histogram->total_sum / histogram->total_count;
+}
+
+void histogram_write(const Histogram *histogram, FILE *file, const char *name)
+{
+    for (int i = 0; i < histogram->counts_length; i++) {
+        if (histogram->counts[i] > 0) {
+            fprintf(file, "%s\t%lld\t%lld\t%llu\n", name, (long long) lowest_value_at(histogram, i),
+                    (long long) highest_value_at(histogram, i), (unsigned long long) histogram->counts[i]);
+        }
+    }
+}
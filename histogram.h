@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstdio>
+
+#ifndef NEO4J_C_DRIVER_HISTOGRAM_H
+#define NEO4J_C_DRIVER_HISTOGRAM_H
+
+// HDR-style histogram: values are grouped into power-of-two buckets, each split into enough
+// linear sub-buckets to keep the given number of significant decimal digits. Memory depends
+// only on the value range, so recording is O(1) whatever the number of samples.
+struct Histogram
+{
+    int64_t highest_value;              // larger values are recorded as this
+    int significant_digits;
+    int sub_bucket_half_count_magnitude;
+    int64_t sub_bucket_half_count;
+    int64_t sub_bucket_mask;
+    int bucket_count;
+    int counts_length;
+    uint64_t *counts;
+
+    uint64_t total_count;
+    int64_t total_sum;                  // exact, for means
+    int64_t min_value;
+    int64_t max_value;
+};
+
+Histogram *histogram_create(int64_t highest_value, int significant_digits);
+
+void histogram_destroy(Histogram *histogram);
+
+void histogram_reset(Histogram *histogram);
+
+void histogram_record(Histogram *histogram, int64_t value);
+
+// Adds the counts of `source` to `target`; both must have been created with the same arguments
+bool histogram_merge(Histogram *target, const Histogram *source);
+
+int64_t histogram_value_at_percentile(const Histogram *histogram, double percentile);
+
+double histogram_mean(const Histogram *histogram);
+
+// Writes one "name<TAB>lowest<TAB>highest<TAB>count" line per non-empty sub-bucket
+void histogram_write(const Histogram *histogram, FILE *file, const char *name);
+
+#endif // NEO4J_C_DRIVER_HISTOGRAM_H
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "intern.h"
+
+static const uint32_t INTERN_INITIAL_CAPACITY = 64;
+static const size_t INTERN_INITIAL_DATA_CAPACITY = 1024;
+
+Intern_Table *intern_create()
+{
+    Intern_Table *table = new Intern_Table;
+    table->slot_count = INTERN_INITIAL_CAPACITY * 2;
+    table->slots = new uint32_t[table->slot_count]();
+    table->capacity = INTERN_INITIAL_CAPACITY;
+    table->offsets = new uint32_t[table->capacity + 1];
+    table->offsets[0] = 0;
+    table->hashes = new uint32_t[table->capacity];
+    table->count = 0;
+    table->data_capacity = INTERN_INITIAL_DATA_CAPACITY;
+    table->data = new char[table->data_capacity];
+    table->data_size = 0;
+    return table;
+}
+
+void intern_destroy(Intern_Table *table)
+{
+    delete[] table->slots;
+    delete[] table->offsets;
+    delete[] table->hashes;
+    delete[] table->data;
+    delete table;
+}
+
+// FNV-1a: keys and labels are short, so a simple byte-at-a-time hash is enough
+uint32_t intern_hash(const char *text, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool intern_matches(const Intern_Table *table, uint32_t id, uint32_t hash, const char *text, size_t size)
+{
+    size_t existing_size = table->offsets[id + 1] - table->offsets[id] - 1;
+    return table->hashes[id] == hash and existing_size == size and
+           memcmp(table->data + table->offsets[id], text, size) == 0;
+}
+
+uint32_t intern_lookup(const Intern_Table *table, uint32_t hash, const char *text, size_t size, uint32_t *slot)
+{
+    uint32_t mask = table->slot_count - 1;
+    uint32_t index = hash & mask;
+    while (table->slots[index] != 0) {
+        uint32_t id = table->slots[index] - 1;
+        if (intern_matches(table, id, hash, text, size)) {
+            *slot = index;
+            return id;
+        }
+        index = (index + 1) & mask;
+    }
+    *slot = index;
+    return INTERN_NONE;
+}
+
+uint32_t intern_find(const Intern_Table *table, const char *text, size_t size)
+{
+    uint32_t slot;
+    return intern_lookup(table, intern_hash(text, size), text, size, &slot);
+}
+
+void intern_grow(Intern_Table *table)
+{
+    uint32_t capacity = table->capacity * 2;
+    uint32_t *offsets = new uint32_t[capacity + 1];
+    memcpy(offsets, table->offsets, (table->count + 1) * sizeof(uint32_t));
+    delete[] table->offsets;
+    table->offsets = offsets;
+    uint32_t *hashes = new uint32_t[capacity];
+    memcpy(hashes, table->hashes, table->count * sizeof(uint32_t));
+    delete[] table->hashes;
+    table->hashes = hashes;
+    table->capacity = capacity;
+
+    // Keep the load factor at or below one half
+    delete[] table->slots;
+    table->slot_count = capacity * 2;
+    table->slots = new uint32_t[table->slot_count]();
+    uint32_t mask = table->slot_count - 1;
+    for (uint32_t id = 0; id < table->count; id++) {
+        uint32_t index = table->hashes[id] & mask;
+        while (table->slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        table->slots[index] = id + 1;
+    }
+}
+
+uint32_t intern_id(Intern_Table *table, const char *text, size_t size)
+{
+    uint32_t hash = intern_hash(text, size);
+    uint32_t slot;
+    uint32_t id = intern_lookup(table, hash, text, size, &slot);
+    if (id != INTERN_NONE) {
+        return id;
+    }
+    if (table->count == table->capacity) {
+        intern_grow(table);
+        intern_lookup(table, hash, text, size, &slot);
+    }
+    if (table->data_size + size + 1 > table->data_capacity) {
+        size_t data_capacity = table->data_capacity;
+        while (table->data_size + size + 1 > data_capacity) {
+            data_capacity *= 2;
+        }
+        char *data = new char[data_capacity];
+        memcpy(data, table->data, table->data_size);
+        delete[] table->data;
+        table->data = data;
+        table->data_capacity = data_capacity;
+    }
+    id = table->count;
+    memcpy(table->data + table->data_size, text, size);
+    table->data[table->data_size + size] = '\0';
+    table->data_size += size + 1;
+    table->hashes[id] = hash;
+    table->offsets[id + 1] = (uint32_t) table->data_size;
+    table->slots[slot] = id + 1;
+    table->count += 1;
+    return id;
+}
+
+uint32_t intern_id_bounded(Intern_Table *table, const char *text, size_t size, uint32_t max_count, size_t max_size)
+{
+    if (size > max_size) {
+        return INTERN_NONE;
+    }
+    return table->count < max_count ? intern_id(table, text, size) : intern_find(table, text, size);
+}
+
+const char *intern_text(const Intern_Table *table, uint32_t id, size_t *size)
+{
+    if (size != NULL) {
+        *size = table->offsets[id + 1] - table->offsets[id] - 1;
+    }
+    return table->data + table->offsets[id];
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef NEO4J_C_DRIVER_INTERN_H
+#define NEO4J_C_DRIVER_INTERN_H
+
+static const uint32_t INTERN_NONE = 0xFFFFFFFF;
+
+// Maps strings to small dense IDs, storing each distinct string once. IDs are stable for the
+// life of the table; the text behind them may move as the table grows, so look it up by ID.
+struct Intern_Table
+{
+    uint32_t *slots;            // open-addressed hash slots holding ID + 1, or 0 when empty
+    uint32_t slot_count;        // always a power of two
+
+    uint32_t *offsets;          // start of each string in data, plus one final end offset
+    uint32_t *hashes;
+    uint32_t count;
+    uint32_t capacity;
+
+    char *data;                 // strings, each followed by a null terminator
+    size_t data_size;
+    size_t data_capacity;
+};
+
+Intern_Table *intern_create();
+
+void intern_destroy(Intern_Table *table);
+
+uint32_t intern_hash(const char *text, size_t size);
+
+// ID of a string, adding it to the table if it is new
+uint32_t intern_id(Intern_Table *table, const char *text, size_t size);
+
+// ID of a string already in the table, or INTERN_NONE
+uint32_t intern_find(const Intern_Table *table, const char *text, size_t size);
+
+// ID of a string, adding it only while the table holds fewer than max_count strings. Strings
+// longer than max_size are never looked up, and INTERN_NONE is returned for them.
+uint32_t intern_id_bounded(Intern_Table *table, const char *text, size_t size, uint32_t max_count, size_t max_size);
+
+const char *intern_text(const Intern_Table *table, uint32_t id, size_t *size);
+
+
+#endif // NEO4J_C_DRIVER_INTERN_H
@@ -15,18 +15,32 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <thread>
 #include <string.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 
+#include "arrow.h"
+#include "async.h"
 #include "bolt.h"
+#include "bolt_pool.h"
+#include "cursor.h"
+#include "graph.h"
+#include "histogram.h"
+#include "output.h"
+#include "stats.h"
 
 using namespace std;
 using namespace chrono;
 
 typedef time_point<high_resolution_clock> Time;
 
+static const int64_t HISTOGRAM_HIGHEST_VALUE = 60000000000;     // one minute, in nanoseconds
+static const int HISTOGRAM_SIGNIFICANT_DIGITS = 3;
+
 struct TimeSet
 {
     Time init;
@@ -35,62 +49,182 @@ struct TimeSet
     Time run_summary_received;
     Time pull_summary_received;
     Time done;
+    unsigned long records;
+    unsigned long failures;         // results ending in FAILURE
+    unsigned long ignored;          // and in IGNORED, following a failure
 };
 
 enum PrintFormat {
     NONE = 0,
     JSON = 1,
+    ARROW = 2,
+};
+
+struct RunOptions
+{
+    PrintFormat format;
+    size_t batch_rows;              // for Arrow output, rows per record batch
+    size_t batch_bytes;             // and the size at which a batch is cut short
 };
 
-void print_json_string(char *buffer, int32_t size)
+static const size_t DEFAULT_BATCH_ROWS = 65536;
+static const size_t DEFAULT_BATCH_BYTES = 0x4000000;
+
+void print_next_value(char **reader, Output *output, PrintFormat format, Graph_Store *graph);
+
+void print_graph_text(Graph_Store *graph, uint32_t id, Output *output)
 {
-    cout << '"';
-    for (int i = 0; i < size; i++) {
-        unsigned char ch = (unsigned char) buffer[i];
-        if (ch >= ' ' and ch <= '~') {
-            cout << buffer[i];
+    size_t size;
+    const char *text = graph_text(graph, id, &size);
+    output_write_json_string(output, text, size);
+}
+
+void print_graph_properties(Graph_Store *graph, uint32_t first, uint32_t count, Output *output)
+{
+    output_write_char(output, '{');
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) {
+            output_write(output, ", ", 2);
         }
-        else {
-            switch (ch) {
-                case '"':
-                    cout << "\\\"";
-                    break;
-                case '\\':
-                    cout << "\\\\";
-                    break;
-                case '\b':
-                    cout << "\\b";
-                    break;
-                case '\f':
-                    cout << "\\f";
-                    break;
-                case '\n':
-                    cout << "\\n";
-                    break;
-                case '\r':
-                    cout << "\\r";
-                    break;
-                case '\t':
-                    cout << "\\t";
-                    break;
-                default:
-                    // TODO: unicode character escaping as \uXXXX
-                    cout << "\\x" << (ch < 0x10 ? "0" : "") << uppercase << hex << (int) ch;
+        const Graph_Property *property = &graph->properties[first + i];
+        print_graph_text(graph, property->key, output);
+        output_write(output, ": ", 2);
+        switch (property->type) {
+            case PACKSTREAM_NULL:
+                output_write(output, "null", 4);
+                break;
+            case PACKSTREAM_BOOLEAN:
+                output_write_text(output, property->boolean ? "true" : "false");
+                break;
+            case PACKSTREAM_INTEGER:
+                output_write_integer(output, property->integer);
+                break;
+            case PACKSTREAM_FLOAT:
+                output_write_float(output, property->number);
+                break;
+            case PACKSTREAM_TEXT:
+                output_write_json_string(output, graph_property_data(graph, property), property->size);
+                break;
+            case PACKSTREAM_LIST:
+            case PACKSTREAM_MAP: {
+                // Decoded without the store, which must not grow while its data is being read
+                char *value = (char *) graph_property_data(graph, property);
+                print_next_value(&value, output, JSON, NULL);
+                break;
             }
+            default:
+                output_write_char(output, '?');
+        }
+    }
+    output_write_char(output, '}');
+}
+
+void print_graph_node(Graph_Store *graph, uint32_t index, Output *output)
+{
+    const Graph_Node *node = &graph->nodes[index];
+    output_write(output, "{\"id\": ", 7);
+    output_write_integer(output, node->id);
+    output_write(output, ", \"labels\": [", 13);
+    for (uint32_t i = 0; i < node->label_count; i++) {
+        if (i > 0) {
+            output_write(output, ", ", 2);
+        }
+        print_graph_text(graph, graph->labels[node->first_label + i], output);
+    }
+    output_write(output, "], \"properties\": ", 17);
+    print_graph_properties(graph, node->first_property, node->property_count, output);
+    output_write_char(output, '}');
+}
+
+void print_graph_relationship(Graph_Store *graph, uint32_t index, Output *output)
+{
+    const Graph_Relationship *relationship = &graph->relationships[index];
+    output_write(output, "{\"id\": ", 7);
+    output_write_integer(output, relationship->id);
+    output_write(output, ", \"start\": ", 11);
+    output_write_integer(output, relationship->start);
+    output_write(output, ", \"end\": ", 9);
+    output_write_integer(output, relationship->end);
+    output_write(output, ", \"type\": ", 10);
+    print_graph_text(graph, relationship->type, output);
+    output_write(output, ", \"properties\": ", 16);
+    print_graph_properties(graph, relationship->first_property, relationship->property_count, output);
+    output_write_char(output, '}');
+}
+
+// A path is written as its entities in order: node, relationship, node...
+void print_graph_path(Graph_Store *graph, uint32_t index, Output *output)
+{
+    const Graph_Path *path = &graph->paths[index];
+    output_write_char(output, '[');
+    for (uint32_t i = 0; i <= 2 * path->length; i++) {
+        if (i > 0) {
+            output_write(output, ", ", 2);
+        }
+        uint32_t entry = graph->path_entries[path->first_entry + i];
+        if (i % 2 == 0) {
+            print_graph_node(graph, entry, output);
+        }
+        else {
+            print_graph_relationship(graph, entry, output);
         }
     }
-    cout << '"';
+    output_write_char(output, ']');
 }
 
-void print_next_value(Bolt *bolt, PrintFormat format)
+// Nodes, relationships and paths are decoded into the graph store, if there is one; any
+// other structure is written as ?
+void print_next_structure(char **reader, Output *output, Graph_Store *graph)
 {
-    switch (packstream_next_type(bolt->reader))
+    char *start = *reader;
+    int32_t size;
+    char signature = 0;
+    packstream_read_structure_header(&start, &size, &signature);
+    start = *reader;
+    uint32_t index;
+    if (graph != NULL) {
+        switch (signature) {
+            case NEO4J_NODE:
+                if (graph_read_node(graph, reader, &index)) {
+                    print_graph_node(graph, index, output);
+                    return;
+                }
+                break;
+            case NEO4J_RELATIONSHIP:
+            case NEO4J_UNBOUND_RELATIONSHIP:
+                if (graph_read_relationship(graph, reader, &index)) {
+                    print_graph_relationship(graph, index, output);
+                    return;
+                }
+                break;
+            case NEO4J_PATH:
+                if (graph_read_path(graph, reader, &index)) {
+                    print_graph_path(graph, index, output);
+                    return;
+                }
+                break;
+            default:
+                ;
+        }
+    }
+    *reader = start;
+    packstream_skip(reader);
+    output_write_char(output, '?');
+}
+
+void print_next_value(char **reader, Output *output, PrintFormat format, Graph_Store *graph)
+{
+    if (format == NONE) {
+        packstream_skip(reader);
+        return;
+    }
+    switch (packstream_next_type(*reader))
     {
         case PACKSTREAM_NULL: {
-            packstream_read_null(&bolt->reader);
+            packstream_read_null(reader);
             switch (format) {
                 case JSON:
-                    cout << "null";
+                    output_write(output, "null", 4);
                 default:
                     ;
             }
@@ -98,10 +232,10 @@ void print_next_value(Bolt *bolt, PrintFormat format)
         }
         case PACKSTREAM_BOOLEAN: {
             bool value;
-            packstream_read_boolean(&bolt->reader, &value);
+            packstream_read_boolean(reader, &value);
             switch (format) {
                 case JSON:
-                    cout << (value ? "true" : "false");
+                    output_write_text(output, value ? "true" : "false");
                 default:
                     ;
             }
@@ -109,10 +243,10 @@ void print_next_value(Bolt *bolt, PrintFormat format)
         }
         case PACKSTREAM_INTEGER: {
             int64_t value;
-            packstream_read_integer(&bolt->reader, &value);
+            packstream_read_integer(reader, &value);
             switch (format) {
                 case JSON:
-                    cout << value;
+                    output_write_integer(output, value);
                 default:
                     ;
             }
@@ -120,10 +254,10 @@ void print_next_value(Bolt *bolt, PrintFormat format)
         }
         case PACKSTREAM_FLOAT: {
             double value;
-            packstream_read_float(&bolt->reader, &value);
+            packstream_read_float(reader, &value);
             switch (format) {
                 case JSON:
-                    cout << value;
+                    output_write_float(output, value);
                 default:
                     ;
             }
@@ -131,11 +265,11 @@ void print_next_value(Bolt *bolt, PrintFormat format)
         }
         case PACKSTREAM_TEXT: {
             int32_t size;
-            char *value;
-            packstream_read_text(&bolt->reader, &size, &value);
+            const char *value;
+            packstream_read_text_view(reader, &size, &value);
             switch (format) {
                 case JSON:
-                    print_json_string(value, size);
+                    output_write_json_string(output, value, (size_t) size);
                 default:
                     ;
             }
@@ -143,17 +277,17 @@ void print_next_value(Bolt *bolt, PrintFormat format)
         }
         case PACKSTREAM_LIST: {
             int32_t size;
-            packstream_read_list_header(&bolt->reader, &size);
+            packstream_read_list_header(reader, &size);
             switch (format) {
                 case JSON:
-                    cout << '[';
+                    output_write_char(output, '[');
                     for (int i = 0; i < size; i++) {
                         if (i > 0) {
-                            cout << ", ";
+                            output_write(output, ", ", 2);
                         }
-                        print_next_value(bolt, format);
+                        print_next_value(reader, output, format, graph);
                     }
-                    cout << ']';
+                    output_write_char(output, ']');
                 default:
                     ;
             }
@@ -161,229 +295,537 @@ void print_next_value(Bolt *bolt, PrintFormat format)
         }
         case PACKSTREAM_MAP: {
             int32_t size;
-            packstream_read_map_header(&bolt->reader, &size);
+            packstream_read_map_header(reader, &size);
             switch (format) {
                 case JSON:
-                    cout << '{';
+                    output_write_char(output, '{');
                     for (int i = 0; i < size; i++) {
                         if (i > 0) {
-                            cout << ", ";
+                            output_write(output, ", ", 2);
                         }
-                        print_next_value(bolt, format);
-                        cout << ": ";
-                        print_next_value(bolt, format);
+                        print_next_value(reader, output, format, graph);
+                        output_write(output, ": ", 2);
+                        print_next_value(reader, output, format, graph);
                     }
-                    cout << '}';
+                    output_write_char(output, '}');
                 default:
                     ;
             }
             break;
         }
+        case PACKSTREAM_STRUCTURE: {
+            switch (format) {
+                case JSON:
+                    print_next_structure(reader, output, graph);
+                    break;
+                default:
+                    packstream_skip(reader);
+            }
+            break;
+        }
         default: {
-            cout << '?';
+            packstream_skip(reader);
+            output_write_char(output, '?');
         }
     }
 }
 
-void print_next_separated_list(Bolt *bolt, char separator, PrintFormat format)
-{
-    int32_t size;
-    packstream_read_list_header(&bolt->reader, &size);
-    for (long i = 0; i < size; i++) {
-        if (i > 0 and format != NONE) cout << separator;
-        print_next_value(bolt, format);
-    }
-    if (format != NONE) cout << endl;
-}
-
 int print_help(int argc, char *argv[])
 {
     puts("usage: ...");
     return 0;
 }
 
-int run(const char *statement, size_t parameter_count, PackStream_Pair *parameters, PrintFormat format)
+// Stream the result as Arrow record batches, with a schema typed from the first batch
+void export_arrow(Bolt_Cursor *cursor, Output *output, const RunOptions *options)
 {
-    Bolt *bolt = bolt_connect("127.0.0.1", 7687);
-    //printf("Using protocol version %d\n", bolt->version);
+    Arrow_Writer *writer = arrow_writer_open(output);
+    Bolt_Columns *columns = bolt_columns_create(cursor);
+    bolt_columns_fill(columns, cursor, options->batch_rows, options->batch_bytes);
+    arrow_write_schema(writer, columns);
+    bolt_columns_lock_types(columns);
+    while (columns->row_count > 0) {
+        arrow_write_batch(writer, columns);
+        bolt_columns_clear(columns);
+        bolt_columns_fill(columns, cursor, options->batch_rows, options->batch_bytes);
+    }
+    size_t rejected = 0;
+    for (int32_t c = 0; c < columns->column_count; c++) {
+        rejected += columns->columns[c].rejected_count;
+    }
+    if (rejected > 0) {
+        cerr << rejected << " values did not fit the schema and were written as null" << endl;
+    }
+    bolt_columns_destroy(columns);
+    arrow_writer_close(writer);
+}
 
-    bolt_init(bolt, "seabolt/1.0");
-    bolt_send(bolt);
-    bolt_recv(bolt);
+int run(const char *statement, size_t parameter_count, PackStream_Pair *parameters, const RunOptions *options)
+{
+    PrintFormat format = options->format;
+    Bolt_Pool *pool = bolt_pool_create("127.0.0.1", 7687, "seabolt/1.0", 1, DEFAULT_POOL_IDLE_TIMEOUT);
+    Bolt *bolt = bolt_pool_acquire(pool);
+    if (bolt == NULL) {
+        cerr << "Could not connect" << endl;
+        bolt_pool_destroy(pool);
+        return 1;
+    }
+    Output *output = output_open(STDOUT_FILENO, OUTPUT_BUFFER_SIZE);
 
     bolt_run(bolt, statement, parameter_count, parameters);
     bolt_pull_all(bolt);
     bolt_send(bolt);
 
     // Header
-    bolt_recv(bolt);
-    PackStream_Type type = packstream_next_type(bolt->reader);
-    if (type == PACKSTREAM_MAP) {
-        int32_t size;
-        packstream_read_map_header(&bolt->reader, &size);
-        for (long i = 0; i < size; i++) {
-            int32_t key_size;
-            char *key;
-            packstream_read_text(&bolt->reader, &key_size, &key);
-            if (strcmp(key, "fields") == 0) {
-                print_next_separated_list(bolt, '\t', format);
-            }
-            else {
-                print_next_value(bolt, NONE);
-            }
+    Bolt_Cursor *cursor = bolt_cursor_open(bolt);
+    if (format == ARROW) {
+        if (cursor->state != BOLT_CURSOR_FAILED) {
+            export_arrow(cursor, output, options);
         }
-    } else {
-        cerr << "Map expected" << endl;
+    }
+    else if (format != NONE and cursor->field_count > 0) {
+        for (int32_t i = 0; i < cursor->field_count; i++) {
+            if (i > 0) output_write_char(output, '\t');
+            size_t size;
+            const char *name = bolt_cursor_field_name(cursor, i, &size);
+            output_write_json_string(output, name, size);
+        }
+        output_write_char(output, '\n');
     }
 
-    do {
-        bolt_recv(bolt);
-        if (bolt->message_signature == RECORD_MESSAGE) {
-            print_next_separated_list(bolt, '\t', format);
-        } else {
-            cout << endl;
+    // Entities are only needed while their record is written
+    Graph_Store *graph = graph_create(bolt->strings);
+    while (format != ARROW and bolt_cursor_fetch(cursor)) {
+        graph_clear(graph);
+        for (int32_t i = 0; i < cursor->record_size; i++) {
+            if (i > 0 and format != NONE) output_write_char(output, '\t');
+            char *value = bolt_cursor_field(cursor, i);
+            print_next_value(&value, output, format, graph);
         }
-    } while (bolt->message_signature == RECORD_MESSAGE);
+        if (format != NONE) output_write_char(output, '\n');
+    }
+    if (format != ARROW) {
+        output_write_char(output, '\n');
+    }
+    // A FAILURE from the server and a lost connection both leave the cursor failed
+    int status = 0;
+    if (cursor->state == BOLT_CURSOR_FAILED) {
+        output_flush(output);
+        cerr << (cursor->failure_code ? cursor->failure_code : "Failure") << ": "
+             << (cursor->failure_message ? cursor->failure_message : "") << endl;
+        status = 1;
+    }
 
-    bolt_disconnect(bolt);
+    graph_destroy(graph);
+    bolt_cursor_close(cursor);
+    bolt_pool_release(pool, bolt);
+    bolt_pool_destroy(pool);
+    output_close(output);
 
-    return 0;
+    return status;
 }
 
-TimeSet bench_one(Bolt * bolt, const char *statement, size_t parameter_count, PackStream_Pair *parameters)
+struct BenchOptions
 {
-    TimeSet times;
-    PackStream_Type type;
-    
-    times.init = high_resolution_clock::now();
+    const char *host;
+    in_port_t port;
+    unsigned int threads;
+    unsigned int connections;       // per thread
+    unsigned int depth;             // RUN/PULL_ALL pairs sent together on each connection
+    unsigned long count;            // transactions to measure across all threads, unless a duration is given
+    double duration;                // seconds to measure for, or 0
+    double warmup;                  // seconds to run for before measuring
+    const char *histogram_path;     // file to write the raw latency histograms to, or NULL
+};
 
-    // Prepare RUN/PULL_ALL request
-    bolt_run(bolt, statement, parameter_count, parameters);
-    bolt_pull_all(bolt);
-    times.req_prepared = high_resolution_clock::now();
+// State of one load-generating thread, which records only into its own storage
+struct BenchWorker
+{
+    const BenchOptions *options;
+    Bolt_Pool *pool;
+    const char *statement;
+    size_t parameter_count;
+    PackStream_Pair *parameters;
+    atomic<unsigned int> *warmed_up;
+
+    Histogram *overall;             // nanoseconds per batch
+    Histogram *network;
+    Histogram *wait;
+    unsigned long transactions;
+    unsigned long records;
+    unsigned long failures;
+    unsigned long ignored;
+    size_t arena_high_water;
+    size_t arena_reserved;
+    size_t pool_high_water;
+    Time start;
+    Time end;
+    bool failed;
+#ifdef SEABOLT_STATS
+    Bolt_Stats stats;               // driver activity while measuring
+#endif
+};
 
-    // Send RUN/PULL_ALL request
-    bolt_send(bolt);
-    times.req_sent = high_resolution_clock::now();
-
-    // Receive RUN summary
-    bolt_recv(bolt);
-    times.run_summary_received = high_resolution_clock::now();
-
-    // Parse RUN summary
-    type = packstream_next_type(bolt->reader);
-    if (type == PACKSTREAM_MAP) {
-        int32_t size;
-        packstream_read_map_header(&bolt->reader, &size);
-        for (long i = 0; i < size; i++) {
-            int32_t key_size;
-            char *key;
-            packstream_read_text(&bolt->reader, &key_size, &key);
-            if (strcmp(key, "fields") == 0) {
-                print_next_separated_list(bolt, '\t', NONE);
-            }
-            else {
-                print_next_value(bolt, NONE);
-            }
+// One batch of `depth` RUN/PULL_ALL pairs on each connection. All batches are sent before any
+// is read, so every connection has a batch in flight at once.
+void bench_round(Bolt **bolts, unsigned int connections, const char *statement, size_t parameter_count,
+                 PackStream_Pair *parameters, unsigned int depth, TimeSet *times)
+{
+    for (unsigned int c = 0; c < connections; c++) {
+        times[c].init = high_resolution_clock::now();
+
+        // Prepare RUN/PULL_ALL requests
+        for (unsigned int i = 0; i < depth; i++) {
+            bolt_run(bolts[c], statement, parameter_count, parameters);
+            bolt_pull_all(bolts[c]);
         }
-    } else {
-        cerr << "Map expected" << endl;
+        times[c].req_prepared = high_resolution_clock::now();
+
+        // Send RUN/PULL_ALL requests
+        bolt_send(bolts[c]);
+        times[c].req_sent = high_resolution_clock::now();
     }
 
-    // Receive and parse PULL_ALL detail
-    do {
-        bolt_recv(bolt);
-        if (bolt->message_signature == RECORD_MESSAGE) {
-            print_next_separated_list(bolt, '\t', NONE);
-        }
-    } while (bolt->message_signature == RECORD_MESSAGE);
-    times.pull_summary_received = high_resolution_clock::now();
+    for (unsigned int c = 0; c < connections; c++) {
+        times[c].records = 0;
+        times[c].failures = 0;
+        times[c].ignored = 0;
+        for (unsigned int i = 0; i < depth; i++) {
+            // Receive and parse RUN summary
+            Bolt_Cursor *cursor = bolt_cursor_open(bolts[c]);
+            if (i == 0) {
+                times[c].run_summary_received = high_resolution_clock::now();
+            }
 
-    // Parse PULL_ALL summary
-    type = packstream_next_type(bolt->reader);
-    if (type == PACKSTREAM_MAP) {
-        int32_t size;
-        packstream_read_map_header(&bolt->reader, &size);
-        for (long i = 0; i < size; i++) {
-            int32_t key_size;
-            char *key;
-            packstream_read_text(&bolt->reader, &key_size, &key);
-            print_next_value(bolt, NONE);
+            // Receive PULL_ALL detail; records are never decoded as no field is read
+            while (bolt_cursor_fetch(cursor)) {
+            }
+            times[c].records += cursor->record_count;
+            if (cursor->state == BOLT_CURSOR_FAILED) {
+                // An IGNORED result carries no code but leaves the server awaiting acknowledgement
+                if (cursor->failure_code == NULL and cursor->failure_pending) {
+                    times[c].ignored += 1;
+                }
+                else {
+                    times[c].failures += 1;
+                }
+            }
+            bolt_cursor_close(cursor);
         }
-    } else {
-        cerr << "Map expected" << endl;
+        times[c].pull_summary_received = high_resolution_clock::now();
+
+        times[c].done = high_resolution_clock::now();
     }
-    
-    times.done = high_resolution_clock::now();
-    
-    return times;
 }
 
-int bench(const char *statement, size_t parameter_count, PackStream_Pair *parameters, unsigned int times)
+void bench_worker(BenchWorker *worker)
 {
+    const BenchOptions *options = worker->options;
+    unsigned int connections = options->connections;
+    Bolt **bolts = new Bolt *[connections];
+    unsigned int acquired = 0;
+    while (acquired < connections) {
+        bolts[acquired] = bolt_pool_acquire(worker->pool);
+        if (bolts[acquired] == NULL) {
+            break;
+        }
+        acquired += 1;
+    }
+    worker->failed = acquired < connections;
+    TimeSet *round = new TimeSet[connections];
+
+    Time warmup_end = high_resolution_clock::now() + duration_cast<high_resolution_clock::duration>(
+            duration<double>(options->warmup));
+    while (!worker->failed and high_resolution_clock::now() < warmup_end) {
+        bench_round(bolts, connections, worker->statement, worker->parameter_count, worker->parameters,
+                    options->depth, round);
+    }
 
-    system_clock clock = high_resolution_clock();
-    TimeSet * checkpoints = new TimeSet[times];
-
-    Bolt *bolt = bolt_connect("127.0.0.1", 7687);
-    //printf("Using protocol version %d\n", bolt->version);
+    // Measure from the same moment in every thread
+    worker->warmed_up->fetch_add(1);
+    while (worker->warmed_up->load() < options->threads) {
+        this_thread::yield();
+    }
 
-    bolt_init(bolt, "seabolt/1.0");
-    bolt_send(bolt);
-    bolt_recv(bolt);
+    unsigned long count = (options->count + options->threads - 1) / options->threads;
+#ifdef SEABOLT_STATS
+    Bolt_Stats stats_before;
+    bolt_stats_thread(&stats_before);
+#endif
+    worker->start = high_resolution_clock::now();
+    Time measure_end = worker->start + duration_cast<high_resolution_clock::duration>(
+            duration<double>(options->duration));
+    while (!worker->failed) {
+        if (options->duration > 0 ? high_resolution_clock::now() >= measure_end : worker->transactions >= count) {
+            break;
+        }
+        bench_round(bolts, connections, worker->statement, worker->parameter_count, worker->parameters,
+                    options->depth, round);
+        for (unsigned int c = 0; c < connections; c++) {
+            TimeSet *times = &round[c];
+            histogram_record(worker->overall, duration_cast<nanoseconds>(times->done - times->init).count());
+            histogram_record(worker->network,
+                             duration_cast<nanoseconds>(times->pull_summary_received - times->req_prepared).count());
+            histogram_record(worker->wait,
+                             duration_cast<nanoseconds>(times->run_summary_received - times->req_sent).count());
+            worker->records += times->records;
+            worker->failures += times->failures;
+            worker->ignored += times->ignored;
+        }
+        worker->transactions += connections * options->depth;
+    }
+    worker->end = high_resolution_clock::now();
+#ifdef SEABOLT_STATS
+    bolt_stats_thread(&worker->stats);
+    for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+        worker->stats.values[i] -= stats_before.values[i];
+    }
+#endif
+
+    for (unsigned int c = 0; c < acquired; c++) {
+        Bolt *bolt = bolts[c];
+        worker->arena_high_water = max(worker->arena_high_water, bolt->arena->high_water);
+        worker->arena_reserved = max(worker->arena_reserved, bolt->arena->reserved);
+        worker->pool_high_water = max(worker->pool_high_water, bolt->pool->high_water);
+        bolt_pool_release(worker->pool, bolt);
+    }
+    delete[] round;
+    delete[] bolts;
+}
 
-    Time t0 = high_resolution_clock::now();
-    for (unsigned int x = 0; x < times; x++) {
-        checkpoints[x] = bench_one(bolt, statement, parameter_count, parameters);
+int bench(const char *statement, size_t parameter_count, PackStream_Pair *parameters, const BenchOptions *options)
+{
+    Bolt_Pool *pool = bolt_pool_create(options->host, options->port, "seabolt/1.0",
+                                       options->threads * options->connections, DEFAULT_POOL_IDLE_TIMEOUT);
+    atomic<unsigned int> warmed_up(0);
+    BenchWorker *workers = new BenchWorker[options->threads];
+    thread *threads = new thread[options->threads];
+    for (unsigned int t = 0; t < options->threads; t++) {
+        BenchWorker *worker = &workers[t];
+        worker->options = options;
+        worker->pool = pool;
+        worker->statement = statement;
+        worker->parameter_count = parameter_count;
+        worker->parameters = parameters;
+        worker->warmed_up = &warmed_up;
+        worker->overall = histogram_create(HISTOGRAM_HIGHEST_VALUE, HISTOGRAM_SIGNIFICANT_DIGITS);
+        worker->network = histogram_create(HISTOGRAM_HIGHEST_VALUE, HISTOGRAM_SIGNIFICANT_DIGITS);
+        worker->wait = histogram_create(HISTOGRAM_HIGHEST_VALUE, HISTOGRAM_SIGNIFICANT_DIGITS);
+        worker->transactions = 0;
+        worker->records = 0;
+        worker->failures = 0;
+        worker->ignored = 0;
+        worker->arena_high_water = 0;
+        worker->arena_reserved = 0;
+        worker->pool_high_water = 0;
+        worker->failed = false;
+        threads[t] = thread(bench_worker, worker);
+    }
+    for (unsigned int t = 0; t < options->threads; t++) {
+        threads[t].join();
+    }
+    delete[] threads;
+
+    // Merge what the workers recorded into the first worker's histograms
+    Histogram *overall = workers[0].overall;
+    Histogram *network = workers[0].network;
+    Histogram *wait = workers[0].wait;
+    unsigned long transactions = 0;
+    unsigned long records = 0;
+    unsigned long failures = 0;
+    unsigned long ignored = 0;
+    size_t arena_high_water = 0;
+    size_t arena_reserved = 0;
+    size_t pool_high_water = 0;
+    bool failed = false;
+#ifdef SEABOLT_STATS
+    Bolt_Stats stats = {};
+#endif
+    Time t0 = workers[0].start;
+    Time t1 = workers[0].end;
+    for (unsigned int t = 0; t < options->threads; t++) {
+        BenchWorker *worker = &workers[t];
+        if (t > 0) {
+            histogram_merge(overall, worker->overall);
+            histogram_merge(network, worker->network);
+            histogram_merge(wait, worker->wait);
+            histogram_destroy(worker->overall);
+            histogram_destroy(worker->network);
+            histogram_destroy(worker->wait);
+        }
+        transactions += worker->transactions;
+        records += worker->records;
+        failures += worker->failures;
+        ignored += worker->ignored;
+        arena_high_water = max(arena_high_water, worker->arena_high_water);
+        arena_reserved = max(arena_reserved, worker->arena_reserved);
+        pool_high_water = max(pool_high_water, worker->pool_high_water);
+        failed = failed or worker->failed;
+#ifdef SEABOLT_STATS
+        for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+            stats.values[i] += worker->stats.values[i];
+        }
+#endif
+        t0 = min(t0, worker->start);
+        t1 = max(t1, worker->end);
+    }
+    if (failed or overall->total_count == 0) {
+        cerr << "Could not connect" << endl;
+        delete[] workers;
+        histogram_destroy(overall);
+        histogram_destroy(network);
+        histogram_destroy(wait);
+        bolt_pool_destroy(pool);
+        return 1;
     }
-    Time t1 = high_resolution_clock::now();
 
-    double tx_per_sec = times / duration_cast<duration<double>>(t1 - t0).count();
+    double tx_per_sec = transactions / duration_cast<duration<double>>(t1 - t0).count();
     cout << tx_per_sec << " tx/sec" << endl;
-
-    duration<double> overall_durations[times];
-    duration<double> network_durations[times];
-    duration<double> wait_durations[times];
-
-    duration<double> network_overhead;
-    duration<double> driver_overhead;
-
-    for (unsigned int x = 0; x < times; x++)
-    {
-        overall_durations[x] = duration_cast<duration<double>>(checkpoints[x].done - checkpoints[x].init);
-        network_durations[x] = duration_cast<duration<double>>(checkpoints[x].pull_summary_received - checkpoints[x].req_prepared);
-        wait_durations[x] = duration_cast<duration<double>>(checkpoints[x].run_summary_received - checkpoints[x].req_sent);
-
-        network_overhead += network_durations[x] - wait_durations[x];
-        driver_overhead += overall_durations[x] - network_durations[x];
+    if (options->threads > 1 or options->connections > 1) {
+        printf("Threads = %u, connections per thread = %u\n", options->threads, options->connections);
+    }
+    if (options->depth > 1) {
+        printf("Pipeline depth = %u (percentiles are per batch)\n", options->depth);
     }
-
-    sort(overall_durations, overall_durations + times);
-    sort(network_durations, network_durations + times);
-    sort(wait_durations, wait_durations + times);
-
-    network_overhead /= times;
-    driver_overhead /= times;
 
     double percentiles[] = {0.0, 10.0, 20.0, 30.0, 40.0, 50.0, 60.0, 70.0,
                             80.0, 90.0, 95.0, 98.0, 99.0, 99.5, 99.9, 100.0};
     for (int i = 0; i < 16; i++) {
         double percentile = percentiles[i];
-        unsigned int index = (unsigned int) floor(percentile * (times - 1) / 100.0);
-        double overall = overall_durations[index].count();
-        double network = network_durations[index].count();
-        double wait = wait_durations[index].count();
-        printf(" %9.1f%% | %9.1fµs | %9.1fµs | %9.1fµs |\n",
-               percentile, 1000000.0 * overall, 1000000.0 * network, 1000000.0 * wait);
+        printf(" %9.1f%% | %9.1fµs | %9.1fµs | %9.1fµs |\n", percentile,
+               histogram_value_at_percentile(overall, percentile) / 1000.0,
+               histogram_value_at_percentile(network, percentile) / 1000.0,
+               histogram_value_at_percentile(wait, percentile) / 1000.0);
     }
 
+    double network_overhead = (double) (network->total_sum - wait->total_sum) / transactions;
+    double driver_overhead = (double) (overall->total_sum - network->total_sum) / transactions;
+
     cout << endl;
-    printf("Mean network overhead = %2.1fµs\n", 1000000.0 * network_overhead.count());
-    printf("Mean driver overhead = %2.1fns\n", 1000000000.0 * driver_overhead.count());
+    printf("Mean network overhead = %2.1fµs\n", network_overhead / 1000.0);
+    printf("Mean driver overhead = %2.1fns\n", driver_overhead);
+    printf("Arena high-water mark = %zu bytes (%zu reserved)\n", arena_high_water, arena_reserved);
+    printf("Pool high-water mark = %zu bytes\n", pool_high_water);
+    printf("Connections opened = %lu, reused = %lu\n", pool->connects, pool->reuses);
+#ifdef SEABOLT_STATS
+    unsigned long long send_calls = stats.values[BOLT_STAT_SEND_CALLS];
+    unsigned long long recv_calls = stats.values[BOLT_STAT_RECV_CALLS];
+    printf("Syscalls per transaction = %.2f (%llu send, %llu recv)\n",
+           (double) (send_calls + recv_calls) / transactions, send_calls, recv_calls);
+    if (records > 0) {
+        printf("Syscalls per record = %.4f (%lu records)\n", (double) (send_calls + recv_calls) / records, records);
+    }
+    printf("Encode time per transaction = %.1fns, decode time per transaction = %.1fns\n",
+           (double) stats.values[BOLT_STAT_ENCODE_NANOS] / transactions,
+           (double) stats.values[BOLT_STAT_DECODE_NANOS] / transactions);
+    printf("Chunks received per message = %.2f, buffer growths = %llu, allocations = %llu\n",
+           (double) stats.values[BOLT_STAT_CHUNKS_RECEIVED] / stats.values[BOLT_STAT_MESSAGES_RECEIVED],
+           (unsigned long long) stats.values[BOLT_STAT_BUFFER_GROWTHS],
+           (unsigned long long) stats.values[BOLT_STAT_ALLOCATIONS]);
+#endif
+
+    // Failed transactions are timed like the rest, so the figures above cannot be trusted
+    int status = 0;
+    if (failures + ignored > 0) {
+        printf("Failed transactions = %lu, ignored = %lu\n", failures, ignored);
+        for (unsigned int t = 0; options->threads > 1 and t < options->threads; t++) {
+            printf("  thread %u: failed = %lu, ignored = %lu\n", t, workers[t].failures, workers[t].ignored);
+        }
+        status = 1;
+    }
+    delete[] workers;
+
+    if (options->histogram_path != NULL) {
+        FILE *file = fopen(options->histogram_path, "w");
+        if (file == NULL) {
+            cerr << "Could not write histograms to '" << options->histogram_path << '\'' << endl;
+            status = 1;
+        }
+        else {
+            histogram_write(overall, file, "overall");
+            histogram_write(network, file, "network");
+            histogram_write(wait, file, "wait");
+            fclose(file);
+        }
+    }
+
+    bolt_pool_destroy(pool);
+    histogram_destroy(overall);
+    histogram_destroy(network);
+    histogram_destroy(wait);
+
+    return status;
+}
+
+struct StreamOptions
+{
+    const char *host;
+    in_port_t port;
+    unsigned int connections;       // concurrent sessions, all on one thread
+    unsigned long count;            // queries run one after another by each session
+};
 
+struct StreamSession
+{
+    const StreamOptions *options;
+    bool connected;
+    unsigned long records;
+    unsigned long failures;
+};
+
+Bolt_Task<void> stream_session(Bolt_Loop *loop, const char *statement, StreamSession *session)
+{
+    const StreamOptions *options = session->options;
+    Bolt *bolt = co_await bolt_async_connect(loop, options->host, options->port);
+    if (bolt == NULL) {
+        co_return;
+    }
+    session->connected = co_await bolt_async_init(loop, bolt, "seabolt/1.0");
+    for (unsigned long i = 0; session->connected and i < options->count; i++) {
+        Bolt_Cursor *cursor = co_await bolt_async_run(loop, bolt, statement, 0, NULL);
+        while (co_await bolt_async_fetch(loop, cursor)) {
+        }
+        session->records += cursor->record_count;
+        if (cursor->state == BOLT_CURSOR_FAILED) {
+            session->failures += 1;
+        }
+        co_await bolt_async_close(loop, cursor);
+    }
     bolt_disconnect(bolt);
+}
 
-    return 0;
+// Run the statement repeatedly over several connections driven by coroutines on one event loop
+int stream(const char *statement, const StreamOptions *options)
+{
+    Bolt_Loop *loop = bolt_loop_create();
+    StreamSession *sessions = new StreamSession[options->connections];
+    Time start = high_resolution_clock::now();
+    for (unsigned int i = 0; i < options->connections; i++) {
+        sessions[i].options = options;
+        sessions[i].connected = false;
+        sessions[i].records = 0;
+        sessions[i].failures = 0;
+        bolt_loop_spawn(loop, stream_session(loop, statement, &sessions[i]));
+    }
+    bool completed = bolt_loop_run(loop);
+    double seconds = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / 1000000000.0;
+
+    unsigned int connected = 0;
+    unsigned long records = 0;
+    unsigned long failures = 0;
+    for (unsigned int i = 0; i < options->connections; i++) {
+        connected += sessions[i].connected ? 1 : 0;
+        records += sessions[i].records;
+        failures += sessions[i].failures;
+    }
+    unsigned long queries = connected * options->count;
+    printf("Connections = %u of %u, queries = %lu, failures = %lu, records = %lu\n",
+           connected, options->connections, queries, failures, records);
+    printf("Time = %.3fs, throughput = %.1f queries/s\n", seconds, queries / seconds);
+
+    delete[] sessions;
+    bolt_loop_destroy(loop);
+    return completed and connected == options->connections and failures == 0 ? 0 : 1;
 }
 
 int main(int argc, char *argv[])
@@ -394,10 +836,123 @@ int main(int argc, char *argv[])
 
     char * command = argv[1];
     if (strcmp(command, "run") == 0) {
-        exit(run(argv[2], 0, NULL, JSON));
+        RunOptions options;
+        options.format = JSON;
+        options.batch_rows = DEFAULT_BATCH_ROWS;
+        options.batch_bytes = DEFAULT_BATCH_BYTES;
+        int arg = 2;
+        while (arg < argc - 1 and strncmp(argv[arg], "--", 2) == 0) {
+            const char *option = argv[arg];
+            const char *value = argv[arg + 1];
+            if (strcmp(option, "--format") == 0 and strcmp(value, "json") == 0) {
+                options.format = JSON;
+            }
+            else if (strcmp(option, "--format") == 0 and strcmp(value, "arrow") == 0) {
+                options.format = ARROW;
+            }
+            else if (strcmp(option, "--batch-rows") == 0) {
+                options.batch_rows = strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--batch-bytes") == 0) {
+                options.batch_bytes = strtoul(value, NULL, 10);
+            }
+            else {
+                cout << "Unknown option '" << option << ' ' << value << '\'' << endl;
+                exit(1);
+            }
+            arg += 2;
+        }
+        if (arg >= argc or options.batch_rows == 0) {
+            exit(print_help(argc, argv));
+        }
+        exit(run(argv[arg], 0, NULL, &options));
     }
     else if (strcmp(command, "bench") == 0) {
-        exit(bench(argv[2], 0, NULL, 100000));
+        BenchOptions options;
+        options.host = "127.0.0.1";
+        options.port = 7687;
+        options.threads = 1;
+        options.connections = 1;
+        options.depth = 1;
+        options.count = 100000;
+        options.duration = 0;
+        options.warmup = 0;
+        options.histogram_path = NULL;
+        int arg = 2;
+        while (arg < argc - 1 and strncmp(argv[arg], "--", 2) == 0) {
+            const char *option = argv[arg];
+            const char *value = argv[arg + 1];
+            if (strcmp(option, "--host") == 0) {
+                options.host = value;
+            }
+            else if (strcmp(option, "--port") == 0) {
+                options.port = (in_port_t) strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--pipeline-depth") == 0) {
+                options.depth = (unsigned int) strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--threads") == 0) {
+                options.threads = (unsigned int) strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--connections") == 0) {
+                options.connections = (unsigned int) strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--count") == 0) {
+                options.count = strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--duration") == 0) {
+                options.duration = strtod(value, NULL);
+            }
+            else if (strcmp(option, "--warmup") == 0) {
+                options.warmup = strtod(value, NULL);
+            }
+            else if (strcmp(option, "--histogram-output") == 0) {
+                options.histogram_path = value;
+            }
+            else {
+                cout << "Unknown option '" << option << '\'' << endl;
+                exit(1);
+            }
+            arg += 2;
+        }
+        if (arg >= argc or options.depth == 0 or options.threads == 0 or options.connections == 0 or
+            (options.count == 0 and options.duration <= 0)) {
+            exit(print_help(argc, argv));
+        }
+        exit(bench(argv[arg], 0, NULL, &options));
+    }
+    else if (strcmp(command, "stream") == 0) {
+        StreamOptions options;
+        options.host = "127.0.0.1";
+        options.port = 7687;
+        options.connections = 1;
+        options.count = 1;
+        int arg = 2;
+        while (arg < argc - 1 and strncmp(argv[arg], "--", 2) == 0) {
+            const char *option = argv[arg];
+            const char *value = argv[arg + 1];
+            if (strcmp(option, "--host") == 0) {
+                options.host = value;
+            }
+            else if (strcmp(option, "--port") == 0) {
+                options.port = (in_port_t) strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--connections") == 0) {
+                options.connections = (unsigned int) strtoul(value, NULL, 10);
+            }
+            else if (strcmp(option, "--count") == 0) {
+                options.count = strtoul(value, NULL, 10);
+            }
+            else {
+                cout << "Unknown option '" << option << '\'' << endl;
+                exit(1);
+            }
+            arg += 2;
+        }
+        if (arg >= argc or options.connections == 0) {
+            exit(print_help(argc, argv));
+        }
+        exit(stream(argv[arg], &options));
     }
     else {
         cout << "Unknown command '" << command << '\'' << endl;
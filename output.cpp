@@ -0,0 +1,245 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <charconv>
+#include <errno.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "output.h"
+
+Output *output_open(int fd, size_t buffer_size)
+{
+    Output *output = new Output;
+    output->fd = fd;
+    output->buffer = new char[buffer_size];
+    output->writer = output->buffer;
+    output->end = output->buffer + buffer_size;
+    output->failed = false;
+    return output;
+}
+
+void output_close(Output *output)
+{
+    output_flush(output);
+    delete[] output->buffer;
+    delete output;
+}
+
+bool output_write_fd(Output *output, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(output->fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            output->failed = true;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool output_flush(Output *output)
+{
+    bool flushed = output_write_fd(output, output->buffer, output->writer - output->buffer);
+    output->writer = output->buffer;
+    return flushed;
+}
+
+// Slow path of output_write: top up and flush the buffer, or bypass it for blocks larger than itself
+void output_write_large(Output *output, const char *data, size_t size)
+{
+    size_t capacity = output->end - output->buffer;
+    if (size >= capacity) {
+        output_flush(output);
+        output_write_fd(output, data, size);
+        return;
+    }
+    size_t head = output->end - output->writer;
+    memcpy(output->writer, data, head);
+    output->writer += head;
+    output_flush(output);
+    memcpy(output->writer, data + head, size - head);
+    output->writer += size - head;
+}
+
+static const char DECIMAL_PAIRS[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+// Integers are formatted two digits at a time, right to left
+void output_write_integer(Output *output, int64_t value)
+{
+    char digits[20];
+    char *end = digits + sizeof digits;
+    char *start = end;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+    while (magnitude >= 100) {
+        unsigned int pair = (unsigned int) (magnitude % 100) * 2;
+        magnitude /= 100;
+        start -= 2;
+        start[0] = DECIMAL_PAIRS[pair];
+        start[1] = DECIMAL_PAIRS[pair + 1];
+    }
+    if (magnitude >= 10) {
+        unsigned int pair = (unsigned int) magnitude * 2;
+        start -= 2;
+        start[0] = DECIMAL_PAIRS[pair];
+        start[1] = DECIMAL_PAIRS[pair + 1];
+    }
+    else {
+        *--start = (char) ('0' + magnitude);
+    }
+    if (value < 0) {
+        *--start = '-';
+    }
+    output_write(output, start, end - start);
+}
+
+// Shortest representation that reads back to the same double
+void output_write_float(Output *output, double value)
+{
+    char digits[32];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof digits, value);
+    output_write(output, digits, result.ptr - digits);
+}
+
+// For each byte, the character that follows the backslash when escaping it in a
+// JSON string, 'u' for a \u00XX escape, or 0 if it can be written as it is.
+// Bytes from 0x80 up are parts of UTF-8 sequences and pass straight through.
+static const char JSON_ESCAPES[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+size_t output_json_plain_prefix_scalar(const char *buffer, size_t size)
+{
+    size_t i = 0;
+    while (i < size and JSON_ESCAPES[(unsigned char) buffer[i]] == 0) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__SSE2__)
+
+size_t output_json_plain_prefix_sse2(const char *buffer, size_t size)
+{
+    const __m128i quote_16 = _mm_set1_epi8('"');
+    const __m128i backslash_16 = _mm_set1_epi8('\\');
+    const __m128i control_16 = _mm_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (buffer + i));
+        __m128i escaped = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, quote_16), _mm_cmpeq_epi8(bytes, backslash_16)),
+                _mm_cmpeq_epi8(_mm_max_epu8(bytes, control_16), control_16));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(escaped);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + output_json_plain_prefix_scalar(buffer + i, size - i);
+}
+
+// Compiled for AVX2 whatever the target, so only called once the CPU is known to support it
+__attribute__((target("avx2")))
+size_t output_json_plain_prefix_avx2(const char *buffer, size_t size)
+{
+    const __m256i quote_32 = _mm256_set1_epi8('"');
+    const __m256i backslash_32 = _mm256_set1_epi8('\\');
+    const __m256i control_32 = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (buffer + i));
+        __m256i escaped = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(bytes, quote_32), _mm256_cmpeq_epi8(bytes, backslash_32)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, control_32), control_32));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(escaped);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + output_json_plain_prefix_sse2(buffer + i, size - i);
+}
+
+bool output_json_avx2_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// Chosen once, before main, from what the CPU running the program supports
+static size_t (*const output_json_scanner)(const char *, size_t) =
+        output_json_avx2_supported() ? output_json_plain_prefix_avx2 : output_json_plain_prefix_sse2;
+
+#else
+
+static size_t (*const output_json_scanner)(const char *, size_t) = output_json_plain_prefix_scalar;
+
+#endif
+
+// Length of the leading run of bytes that need no escaping, scanned 32 or 16 bytes at a
+// time where the CPU supports it
+size_t output_json_plain_prefix(const char *buffer, size_t size)
+{
+    return output_json_scanner(buffer, size);
+}
+
+// Write the escape for a byte that needs one into `sequence`, returning its length
+size_t output_json_escape(unsigned char ch, char *sequence)
+{
+    static const char hex_digits[] = "0123456789ABCDEF";
+    char escape = JSON_ESCAPES[ch];
+    sequence[0] = '\\';
+    sequence[1] = escape;
+    if (escape != 'u') {
+        return 2;
+    }
+    sequence[2] = '0';
+    sequence[3] = '0';
+    sequence[4] = hex_digits[ch >> 4];
+    sequence[5] = hex_digits[ch & 0x0F];
+    return 6;
+}
+
+void output_write_json_string(Output *output, const char *data, size_t size)
+{
+    output_write_char(output, '"');
+    size_t i = 0;
+    while (i < size) {
+        size_t plain = output_json_plain_prefix(data + i, size - i);
+        output_write(output, data + i, plain);
+        i += plain;
+        if (i < size) {
+            char sequence[OUTPUT_JSON_ESCAPE_SIZE];
+            output_write(output, sequence, output_json_escape((unsigned char) data[i], sequence));
+            i++;
+        }
+    }
+    output_write_char(output, '"');
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+
+#ifndef NEO4J_C_DRIVER_OUTPUT_H
+#define NEO4J_C_DRIVER_OUTPUT_H
+
+static const size_t OUTPUT_BUFFER_SIZE = 0x100000;
+
+// Buffered writer onto a file descriptor, flushed in blocks of up to buffer_size bytes
+struct Output
+{
+    int fd;
+    char *buffer;
+    char *writer;
+    char *end;
+    bool failed;
+};
+
+Output *output_open(int fd, size_t buffer_size);
+
+// Flush and release the writer (the file descriptor itself is left open)
+void output_close(Output *output);
+
+bool output_flush(Output *output);
+
+void output_write_large(Output *output, const char *data, size_t size);
+
+inline void output_write(Output *output, const char *data, size_t size)
+{
+    if ((size_t) (output->end - output->writer) >= size) {
+        memcpy(output->writer, data, size);
+        output->writer += size;
+    }
+    else {
+        output_write_large(output, data, size);
+    }
+}
+
+inline void output_write_char(Output *output, char ch)
+{
+    if (output->writer == output->end) {
+        output_flush(output);
+    }
+    *output->writer++ = ch;
+}
+
+inline void output_write_text(Output *output, const char *text)
+{
+    output_write(output, text, strlen(text));
+}
+
+void output_write_integer(Output *output, int64_t value);
+
+void output_write_float(Output *output, double value);
+
+void output_write_json_string(Output *output, const char *data, size_t size);
+
+// Length of the leading run of bytes that can go into a JSON string as they are
+size_t output_json_plain_prefix(const char *buffer, size_t size);
+
+// The scanners output_json_plain_prefix chooses from, which must all agree
+size_t output_json_plain_prefix_scalar(const char *buffer, size_t size);
+
+#if defined(__SSE2__)
+size_t output_json_plain_prefix_sse2(const char *buffer, size_t size);
+
+// Only to be called when output_json_avx2_supported() is true
+size_t output_json_plain_prefix_avx2(const char *buffer, size_t size);
+
+bool output_json_avx2_supported();
+#endif
+
+// Longest escape written by output_json_escape, \u00XX
+static const size_t OUTPUT_JSON_ESCAPE_SIZE = 6;
+
+// Write the escape for a byte that needs one into `sequence`, returning its length
+size_t output_json_escape(unsigned char ch, char *sequence);
+
+
+#endif // NEO4J_C_DRIVER_OUTPUT_H
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that every JSON string scanner the CPU can run agrees with the scalar one, with the
+// first byte needing an escape at each position of blocks of each length, and that
+// output_write_json_string escapes as expected.
+
+#include <cstdio>
+#include <string.h>
+
+#include "output.h"
+
+static const size_t MAX_SCAN_SIZE = 100;
+
+static int failures = 0;
+
+void check(bool passed, const char *what, size_t size, size_t position)
+{
+    if (!passed) {
+        fprintf(stderr, "FAILED: %s (size %zu, escape at %zu)\n", what, size, position);
+        failures += 1;
+    }
+}
+
+void test_scanners(const char *buffer, size_t size, size_t position)
+{
+    size_t expected = output_json_plain_prefix_scalar(buffer, size);
+    check(expected == (position < size ? position : size), "scalar", size, position);
+    check(output_json_plain_prefix(buffer, size) == expected, "dispatched", size, position);
+#if defined(__SSE2__)
+    check(output_json_plain_prefix_sse2(buffer, size) == expected, "sse2", size, position);
+    if (output_json_avx2_supported()) {
+        check(output_json_plain_prefix_avx2(buffer, size) == expected, "avx2", size, position);
+    }
+#endif
+}
+
+void test_json_string(const char *input, const char *expected)
+{
+    size_t size = strlen(input);
+    FILE *file = tmpfile();
+    Output *output = output_open(fileno(file), 16);
+    output_write_json_string(output, input, size);
+    output_close(output);
+    char written[256];
+    rewind(file);
+    size_t written_size = fread(written, 1, sizeof written, file);
+    fclose(file);
+    check(written_size == strlen(expected) and memcmp(written, expected, written_size) == 0, expected, size, 0);
+}
+
+int main()
+{
+    // Plain bytes include UTF-8 continuation bytes, which must not be taken for control characters
+    const char plain[] = {'a', 'Z', ' ', '~', (char) 0x80, (char) 0xC3, (char) 0xA9, (char) 0xFF, 0x7F, '/'};
+    const char escaped[] = {'"', '\\', 0x00, 0x01, '\n', 0x1F};
+    char buffer[MAX_SCAN_SIZE];
+    for (size_t size = 0; size <= MAX_SCAN_SIZE; size++) {
+        for (size_t i = 0; i < size; i++) {
+            buffer[i] = plain[i % sizeof plain];
+        }
+        test_scanners(buffer, size, size);
+        for (size_t position = 0; position < size; position++) {
+            for (size_t e = 0; e < sizeof escaped; e++) {
+                char kept = buffer[position];
+                buffer[position] = escaped[e];
+                test_scanners(buffer, size, position);
+                buffer[position] = kept;
+            }
+        }
+    }
+
+    test_json_string("plain", "\"plain\"");
+    test_json_string("a\"b\\c\nd\x01", "\"a\\\"b\\\\c\\nd\\u0001\"");
+    test_json_string("h\xC3\xA9llo, this string is longer than thirty-two bytes\t",
+                     "\"h\xC3\xA9llo, this string is longer than thirty-two bytes\\t\"");
+
+    puts(failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -18,251 +18,381 @@
 #include <string.h>
 
 #include "packstream.h"
+#include "stats.h"
 
 using namespace std;
 
-PackStream_Type packstream_next_type(const char *buffer)
+// Big-endian loads and stores. PackStream is big-endian throughout, so on little-endian
+// hosts these are a single unaligned move plus a byte swap.
+
+inline uint64_t packstream_to_big_endian(uint64_t value)
 {
-    PackStream_Type type;
-    unsigned char marker = (unsigned char) buffer[0];
-    if (marker < 128 or marker >= 240 or marker == 0xC8 or marker == 0xC9 or marker == 0xCA or marker == 0xCB) {
-        type = PACKSTREAM_INTEGER;
-    }
-    else if (marker == 0xC0) {
-        type = PACKSTREAM_NULL;
-    }
-    else if (marker == 0xC1) {
-        type = PACKSTREAM_FLOAT;
-    }
-    else if (marker == 0xC2 or marker == 0xC3) {
-        type = PACKSTREAM_BOOLEAN;
-    }
-    else if (marker == 0xCC or marker == 0xCD or marker == 0xCE) {
-        type = PACKSTREAM_BYTES;
-    }
-    else if (marker == 0xD0 or marker == 0xD1 or marker == 0xD2) {
-        type = PACKSTREAM_TEXT;
-    }
-    else if (marker == 0xD4 or marker == 0xD5 or marker == 0xD6 or marker == 0xD7) {
-        type = PACKSTREAM_LIST;
-    }
-    else if (marker == 0xD8 or marker == 0xD9 or marker == 0xDA or marker == 0xDB) {
-        type = PACKSTREAM_MAP;
-    }
-    else if (marker == 0xDC or marker == 0xDD) {
-        type = PACKSTREAM_STRUCTURE;
-    }
-    else if (marker == 0xDF) {
-        type = PACKSTREAM_END_OF_STREAM;
-    }
-    else {
-        unsigned char marker_high_nibble = (unsigned char) ((marker & 0xF0) >> 4);
-        if (marker_high_nibble == 0x8) {
-            type = PACKSTREAM_TEXT;
-        }
-        else if (marker_high_nibble == 0x9) {
-            type = PACKSTREAM_LIST;
-        }
-        else if (marker_high_nibble == 0xA) {
-            type = PACKSTREAM_MAP;
-        }
-        else if (marker_high_nibble == 0xB) {
-            type = PACKSTREAM_STRUCTURE;
-        }
-        else {
-            type = PACKSTREAM_RESERVED;
-        }
-    }
-    return type;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap64(value);
+#else
+    return value;
+#endif
 }
 
-bool packstream_read_null(char **buffer)
+inline uint16_t packstream_load_uint16(const char *buffer)
 {
-    unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker == 0xC0) {
-        *buffer += 1;
-    }
-    else {
-        return false;
+    uint16_t value;
+    memcpy(&value, buffer, sizeof value);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+inline uint32_t packstream_load_uint32(const char *buffer)
+{
+    uint32_t value;
+    memcpy(&value, buffer, sizeof value);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+inline uint64_t packstream_load_uint64(const char *buffer)
+{
+    uint64_t value;
+    memcpy(&value, buffer, sizeof value);
+    return packstream_to_big_endian(value);
+}
+
+// Store the low `width` bytes of value in big-endian order
+inline void packstream_store(char *buffer, uint64_t value, size_t width)
+{
+    uint64_t shifted = packstream_to_big_endian(value << (64 - 8 * width));
+    memcpy(buffer, &shifted, width);
+}
+
+// Width index (0 = 1 byte, 1 = 2 bytes, 2 = 4 bytes, 3 = 8 bytes) for a value of n significant bits
+static const unsigned char PACKSTREAM_WIDTH_INDEX[65] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+};
+
+inline int packstream_signed_width_index(int64_t value)
+{
+    return PACKSTREAM_WIDTH_INDEX[64 - __builtin_clrsbll(value)];
+}
+
+inline int packstream_unsigned_width_index(uint64_t value)
+{
+    return PACKSTREAM_WIDTH_INDEX[value == 0 ? 0 : 64 - __builtin_clzll(value)];
+}
+
+// Read a big-endian size or value of the given width (0, 1, 2, 4 or 8 bytes)
+inline uint64_t packstream_load(const char *buffer, int width)
+{
+    switch (width) {
+        case 1:
+            return (uint8_t) buffer[0];
+        case 2:
+            return packstream_load_uint16(buffer);
+        case 4:
+            return packstream_load_uint32(buffer);
+        case 8:
+            return packstream_load_uint64(buffer);
+        default:
+            return 0;
     }
-    return true;
 }
 
-bool packstream_read_boolean(char **buffer, bool *value)
+// Classify a marker byte. Built at compile time into PACKSTREAM_MARKERS below.
+constexpr PackStream_Marker packstream_marker(unsigned int marker)
+{
+    return marker < 0x80 or marker >= 0xF0 ? PackStream_Marker{PACKSTREAM_INTEGER, 0, 0} :
+           marker < 0x90 ? PackStream_Marker{PACKSTREAM_TEXT, 0, (signed char) (marker & 0x0F)} :
+           marker < 0xA0 ? PackStream_Marker{PACKSTREAM_LIST, 0, (signed char) (marker & 0x0F)} :
+           marker < 0xB0 ? PackStream_Marker{PACKSTREAM_MAP, 0, (signed char) (marker & 0x0F)} :
+           marker < 0xC0 ? PackStream_Marker{PACKSTREAM_STRUCTURE, 0, (signed char) (marker & 0x0F)} :
+           marker == 0xC0 ? PackStream_Marker{PACKSTREAM_NULL, 0, 0} :
+           marker == 0xC1 ? PackStream_Marker{PACKSTREAM_FLOAT, 8, 0} :
+           marker <= 0xC3 ? PackStream_Marker{PACKSTREAM_BOOLEAN, 0, 0} :
+           marker >= 0xC8 and marker <= 0xCB ? PackStream_Marker{PACKSTREAM_INTEGER, (unsigned char) (1 << (marker - 0xC8)), 0} :
+           marker >= 0xCC and marker <= 0xCE ? PackStream_Marker{PACKSTREAM_BYTES, (unsigned char) (1 << (marker - 0xCC)), 0} :
+           marker >= 0xD0 and marker <= 0xD2 ? PackStream_Marker{PACKSTREAM_TEXT, (unsigned char) (1 << (marker - 0xD0)), 0} :
+           marker >= 0xD4 and marker <= 0xD6 ? PackStream_Marker{PACKSTREAM_LIST, (unsigned char) (1 << (marker - 0xD4)), 0} :
+           marker == 0xD7 ? PackStream_Marker{PACKSTREAM_LIST, 0, -1} :
+           marker >= 0xD8 and marker <= 0xDA ? PackStream_Marker{PACKSTREAM_MAP, (unsigned char) (1 << (marker - 0xD8)), 0} :
+           marker == 0xDB ? PackStream_Marker{PACKSTREAM_MAP, 0, -1} :
+           marker >= 0xDC and marker <= 0xDD ? PackStream_Marker{PACKSTREAM_STRUCTURE, (unsigned char) (1 << (marker - 0xDC)), 0} :
+           marker == 0xDF ? PackStream_Marker{PACKSTREAM_END_OF_STREAM, 0, 0} :
+           PackStream_Marker{PACKSTREAM_RESERVED, 0, 0};
+}
+
+#define PACKSTREAM_MARKER_ROW(high) \
+    packstream_marker(high | 0x0), packstream_marker(high | 0x1), packstream_marker(high | 0x2), packstream_marker(high | 0x3), \
+    packstream_marker(high | 0x4), packstream_marker(high | 0x5), packstream_marker(high | 0x6), packstream_marker(high | 0x7), \
+    packstream_marker(high | 0x8), packstream_marker(high | 0x9), packstream_marker(high | 0xA), packstream_marker(high | 0xB), \
+    packstream_marker(high | 0xC), packstream_marker(high | 0xD), packstream_marker(high | 0xE), packstream_marker(high | 0xF)
+
+constexpr PackStream_Marker PACKSTREAM_MARKERS[256] = {
+    PACKSTREAM_MARKER_ROW(0x00), PACKSTREAM_MARKER_ROW(0x10), PACKSTREAM_MARKER_ROW(0x20), PACKSTREAM_MARKER_ROW(0x30),
+    PACKSTREAM_MARKER_ROW(0x40), PACKSTREAM_MARKER_ROW(0x50), PACKSTREAM_MARKER_ROW(0x60), PACKSTREAM_MARKER_ROW(0x70),
+    PACKSTREAM_MARKER_ROW(0x80), PACKSTREAM_MARKER_ROW(0x90), PACKSTREAM_MARKER_ROW(0xA0), PACKSTREAM_MARKER_ROW(0xB0),
+    PACKSTREAM_MARKER_ROW(0xC0), PACKSTREAM_MARKER_ROW(0xD0), PACKSTREAM_MARKER_ROW(0xE0), PACKSTREAM_MARKER_ROW(0xF0),
+};
+
+#undef PACKSTREAM_MARKER_ROW
+
+// The one decode step shared by all readers: check the marker against the expected
+// type, then pull out the size (or, for scalars, the raw value) and skip past it
+inline bool packstream_read_header(char **buffer, PackStream_Type type, int64_t *size)
 {
     unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker == 0xC3) {
-        *value = true;
-        *buffer += 1;
-    }
-    else if (marker == 0xC2) {
-        *value = false;
-        *buffer += 1;
-    }
-    else {
+    const PackStream_Marker &info = PACKSTREAM_MARKERS[marker];
+    if (info.type != type) {
         return false;
     }
+    *size = info.size_bytes == 0 ? info.tiny_size : (int64_t) packstream_load(*buffer + 1, info.size_bytes);
+    *buffer += 1 + info.size_bytes;
     return true;
 }
 
-bool packstream_read_integer(char **buffer, int64_t *value)
+inline bool packstream_read_size(char **buffer, PackStream_Type type, int32_t *size)
 {
-    unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker < 128 or marker >= 240) {
-        *value = marker;
-        *buffer += 1;
-    }
-    else if (marker == 0xC8) {
-        *value = (uint8_t) (*buffer)[1];
-        *buffer += 2;
-    }
-    else if (marker == 0xC9) {
-        *value = ((uint8_t) (*buffer)[1] << 8) | ((uint8_t) (*buffer)[2]);
-        *buffer += 3;
-    }
-    else if (marker == 0xCA or marker == 0xCB) {
-        // TODO
-        value = 0;
-    }
-    else {
+    int64_t header;
+    if (!packstream_read_header(buffer, type, &header)) {
         return false;
     }
+    *size = (int32_t) header;
     return true;
 }
 
-bool packstream_read_float(char **buffer, double *value)
+// Every reader below times itself as decoding; the clock is only read with -DSEABOLT_STATS
+
+bool packstream_read_null(char **buffer)
 {
-    // TODO
-    *value = 0.0;
-    *buffer += 9;
-    return true;
+    BOLT_STAT_START(start);
+    int64_t unused;
+    bool read = packstream_read_header(buffer, PACKSTREAM_NULL, &unused);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
 }
 
-bool packstream_read_text(char **buffer, int32_t *size, char **value)
+bool packstream_read_boolean(char **buffer, bool *value)
 {
+    BOLT_STAT_START(start);
     unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker == 0xD0) {
-        *size = (uint8_t) (*buffer)[1];
-        *buffer += 2;
+    int64_t unused;
+    bool read = packstream_read_header(buffer, PACKSTREAM_BOOLEAN, &unused);
+    if (read) {
+        *value = (marker & 0x01) != 0;
     }
-    else if (marker == 0xD1) {
-        *size = ((uint8_t) (*buffer)[1] << 8) | ((uint8_t) (*buffer)[2]);
-        *buffer += 3;
-    }
-    else if (marker == 0xD2) {
-        *size = ((uint8_t) (*buffer)[1] << 24) | ((uint8_t) (*buffer)[2] << 16) |
-                ((uint8_t) (*buffer)[3] << 8) | ((uint8_t) (*buffer)[4]);
-        *buffer += 5;
-    }
-    else {
-        unsigned char marker_high_nibble = (unsigned char) (marker & 0xF0);
-        if (marker_high_nibble == 0x80) {
-            *size = (int32_t) (marker & 0x0F);
-            *buffer += 1;
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+bool packstream_read_integer(char **buffer, int64_t *value)
+{
+    BOLT_STAT_START(start);
+    unsigned char marker = (unsigned char) (*buffer)[0];
+    const PackStream_Marker &info = PACKSTREAM_MARKERS[marker];
+    bool read = info.type == PACKSTREAM_INTEGER;
+    if (read) {
+        if (info.size_bytes == 0) {
+            *value = (int8_t) marker;
         }
         else {
-            return false;
+            // Sign-extend from the top of a 64-bit word
+            int shift = 64 - 8 * info.size_bytes;
+            *value = (int64_t) (packstream_load(*buffer + 1, info.size_bytes) << shift) >> shift;
         }
+        *buffer += 1 + info.size_bytes;
     }
-    *value = new char[*size];
-    memcpy(*value, *buffer, (size_t) *size);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+bool packstream_read_float(char **buffer, double *value)
+{
+    BOLT_STAT_START(start);
+    int64_t bits;
+    bool read = packstream_read_header(buffer, PACKSTREAM_FLOAT, &bits);
+    if (read) {
+        memcpy(value, &bits, sizeof bits);
+    }
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+// A size followed by that many bytes, which are left where they are
+inline bool packstream_read_sized_view(char **buffer, PackStream_Type type, int32_t *size, const char **value)
+{
+    if (!packstream_read_size(buffer, type, size)) {
+        return false;
+    }
+    *value = *buffer;
     *buffer += *size;
     return true;
 }
 
+bool packstream_read_bytes_view(char **buffer, int32_t *size, const char **value)
+{
+    BOLT_STAT_START(start);
+    bool read = packstream_read_sized_view(buffer, PACKSTREAM_BYTES, size, value);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+bool packstream_read_text_header(char **buffer, int32_t *size)
+{
+    BOLT_STAT_START(start);
+    bool read = packstream_read_size(buffer, PACKSTREAM_TEXT, size);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+bool packstream_read_text_view(char **buffer, int32_t *size, const char **value)
+{
+    BOLT_STAT_START(start);
+    bool read = packstream_read_sized_view(buffer, PACKSTREAM_TEXT, size, value);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+bool packstream_read_text(char **buffer, int32_t *size, char **value, Arena *arena)
+{
+    BOLT_STAT_START(start);
+    const char *view;
+    bool read = packstream_read_sized_view(buffer, PACKSTREAM_TEXT, size, &view);
+    if (read and arena != NULL) {
+        *value = arena_copy_text(arena, view, (size_t) *size);
+    }
+    else if (read) {
+        *value = new char[*size + 1];
+        BOLT_STAT_ADD(BOLT_STAT_ALLOCATIONS, 1);
+        memcpy(*value, view, (size_t) *size);
+        (*value)[*size] = '\0';
+    }
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
 bool packstream_read_list_header(char **buffer, int32_t *size)
 {
-    unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker == 0xD4) {
-        *size = (uint8_t) (*buffer)[1];
-        *buffer += 2;
-    }
-    else if (marker == 0xD5) {
-        *size = ((uint8_t) (*buffer)[1] << 8) | ((uint8_t) (*buffer)[2]);
-        *buffer += 3;
-    }
-    else if (marker == 0xD6) {
-        *size = ((uint8_t) (*buffer)[1] << 24) | ((uint8_t) (*buffer)[2] << 16) |
-                ((uint8_t) (*buffer)[3] << 8) | ((uint8_t) (*buffer)[4]);
-        *buffer += 5;
-    }
-    else if (marker == 0xD7) {
-        *size = -1;
-        *buffer += 1;
-    }
-    else {
-        unsigned char marker_high_nibble = (unsigned char) (marker & 0xF0);
-        if (marker_high_nibble == 0x90) {
-            *size = marker & 0x0F;
-            *buffer += 1;
-        }
-        else {
-            return false;
-        }
-    }
-    return true;
+    BOLT_STAT_START(start);
+    bool read = packstream_read_size(buffer, PACKSTREAM_LIST, size);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
 }
 
 bool packstream_read_map_header(char **buffer, int32_t *size)
 {
-    unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker == 0xD8) {
-        *size = (uint8_t) (*buffer)[1];
-        *buffer += 2;
-    }
-    else if (marker == 0xD9) {
-        *size = ((uint8_t) (*buffer)[1] << 8) | ((uint8_t) (*buffer)[2]);
-        *buffer += 3;
-    }
-    else if (marker == 0xDA) {
-        *size = ((uint8_t) (*buffer)[1] << 24) | ((uint8_t) (*buffer)[2] << 16) |
-                ((uint8_t) (*buffer)[3] << 8) | ((uint8_t) (*buffer)[4]);
-        *buffer += 5;
-    }
-    else if (marker == 0xDB) {
-        *size = -1;
-        *buffer += 1;
-    }
-    else {
-        unsigned char marker_high_nibble = (unsigned char) (marker & 0xF0);
-        if (marker_high_nibble == 0xA0) {
-            *size = marker & 0x0F;
-            *buffer += 1;
-        }
-        else {
-            return false;
-        }
-    }
-    return true;
+    BOLT_STAT_START(start);
+    bool read = packstream_read_size(buffer, PACKSTREAM_MAP, size);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
 }
 
 bool packstream_read_structure_header(char **buffer, int32_t *size, char *signature)
 {
-    unsigned char marker = (unsigned char) (*buffer)[0];
-    if (marker == 0xDC) {
-        *size = (uint8_t) (*buffer)[1];
-        *signature = (*buffer)[2];
-        *buffer += 3;
-    }
-    else if (marker == 0xDD) {
-        *size = ((uint8_t) (*buffer)[1] << 8) | ((uint8_t) (*buffer)[2]);
-        *signature = (*buffer)[3];
-        *buffer += 4;
+    BOLT_STAT_START(start);
+    bool read = packstream_read_size(buffer, PACKSTREAM_STRUCTURE, size);
+    if (read) {
+        *signature = (*buffer)[0];
+        *buffer += 1;
     }
-    else {
-        unsigned char marker_high_nibble = (unsigned char) (marker & 0xF0);
-        if (marker_high_nibble == 0xB0) {
-            *size = marker & 0x0F;
-            *signature = (*buffer)[1];
-            *buffer += 2;
-        }
-        else {
-            return false;
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return read;
+}
+
+// How to step over a value starting with a given marker: `fixed` bytes of marker, size
+// and signature, plus size * payload bytes of data, leaving size * children nested
+// values still to be skipped. Streamed containers and invalid markers are flagged.
+struct PackStream_Skip {
+    unsigned char fixed;
+    unsigned char size_bytes;
+    unsigned char tiny_size;
+    unsigned char payload;
+    unsigned char children;
+    bool special;
+};
+
+constexpr PackStream_Skip packstream_skip_info(PackStream_Marker marker)
+{
+    return marker.type == PACKSTREAM_RESERVED or marker.type == PACKSTREAM_END_OF_STREAM or marker.tiny_size < 0 ?
+               PackStream_Skip{1, 0, 0, 0, 0, true} :
+           marker.type == PACKSTREAM_TEXT or marker.type == PACKSTREAM_BYTES ?
+               PackStream_Skip{(unsigned char) (1 + marker.size_bytes), marker.size_bytes, (unsigned char) marker.tiny_size, 1, 0, false} :
+           marker.type == PACKSTREAM_LIST ?
+               PackStream_Skip{(unsigned char) (1 + marker.size_bytes), marker.size_bytes, (unsigned char) marker.tiny_size, 0, 1, false} :
+           marker.type == PACKSTREAM_MAP ?
+               PackStream_Skip{(unsigned char) (1 + marker.size_bytes), marker.size_bytes, (unsigned char) marker.tiny_size, 0, 2, false} :
+           marker.type == PACKSTREAM_STRUCTURE ?
+               PackStream_Skip{(unsigned char) (2 + marker.size_bytes), marker.size_bytes, (unsigned char) marker.tiny_size, 0, 1, false} :
+               PackStream_Skip{(unsigned char) (1 + marker.size_bytes), 0, 0, 0, 0, false};
+}
+
+#define PACKSTREAM_SKIP_ROW(high) \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0x0]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0x1]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0x2]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0x3]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0x4]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0x5]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0x6]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0x7]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0x8]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0x9]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0xA]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0xB]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0xC]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0xD]), \
+    packstream_skip_info(PACKSTREAM_MARKERS[high | 0xE]), packstream_skip_info(PACKSTREAM_MARKERS[high | 0xF])
+
+constexpr PackStream_Skip PACKSTREAM_SKIPS[256] = {
+    PACKSTREAM_SKIP_ROW(0x00), PACKSTREAM_SKIP_ROW(0x10), PACKSTREAM_SKIP_ROW(0x20), PACKSTREAM_SKIP_ROW(0x30),
+    PACKSTREAM_SKIP_ROW(0x40), PACKSTREAM_SKIP_ROW(0x50), PACKSTREAM_SKIP_ROW(0x60), PACKSTREAM_SKIP_ROW(0x70),
+    PACKSTREAM_SKIP_ROW(0x80), PACKSTREAM_SKIP_ROW(0x90), PACKSTREAM_SKIP_ROW(0xA0), PACKSTREAM_SKIP_ROW(0xB0),
+    PACKSTREAM_SKIP_ROW(0xC0), PACKSTREAM_SKIP_ROW(0xD0), PACKSTREAM_SKIP_ROW(0xE0), PACKSTREAM_SKIP_ROW(0xF0),
+};
+
+#undef PACKSTREAM_SKIP_ROW
+
+// Rather than recursing into containers, keep a count of values still to be stepped
+// over: each container adds its children to the count, each value removes itself.
+// Text and bytes are jumped over by their size. Nothing is decoded or allocated.
+static bool packstream_skip_value(char **buffer)
+{
+    char *position = *buffer;
+    int64_t pending = 1;
+    do {
+        const PackStream_Skip &info = PACKSTREAM_SKIPS[(unsigned char) position[0]];
+        if (info.special) {
+            // Streamed list or map: skip entries one by one up to the END_OF_STREAM marker
+            if (PACKSTREAM_MARKERS[(unsigned char) position[0]].tiny_size >= 0) {
+                return false;
+            }
+            int children = packstream_next_type(position) == PACKSTREAM_MAP ? 2 : 1;
+            position += 1;
+            while (packstream_next_type(position) != PACKSTREAM_END_OF_STREAM) {
+                for (int i = 0; i < children; i++) {
+                    if (!packstream_skip_value(&position)) {
+                        return false;
+                    }
+                }
+            }
+            position += 1;
+            pending -= 1;
+            continue;
         }
-    }
+        int64_t size = info.size_bytes == 0 ? info.tiny_size : (int64_t) packstream_load(position + 1, info.size_bytes);
+        position += info.fixed + size * info.payload;
+        pending += size * info.children - 1;
+    } while (pending > 0);
+    *buffer = position;
     return true;
 }
 
+bool packstream_skip(char **buffer)
+{
+    BOLT_STAT_START(start);
+    bool skipped = packstream_skip_value(buffer);
+    BOLT_STAT_STOP(BOLT_STAT_DECODE_NANOS, start);
+    return skipped;
+}
+
 void packstream_write_null(char **buffer)
 {
     size_t byte_size;
@@ -283,109 +413,144 @@ void packstream_write_boolean(char **buffer, bool value)
 
 void packstream_write_integer(char **buffer, int64_t value)
 {
-    size_t byte_size;
     if (-16 <= value && value < 128) {
-        char data[] = {(char) value};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
+        (*buffer)[0] = (char) value;
+        *buffer += 1;
     } else {
-        byte_size = 0;
+        int width_index = packstream_signed_width_index(value);
+        size_t width = (size_t) 1 << width_index;
+        (*buffer)[0] = (char) (0xC8 + width_index);
+        packstream_store(*buffer + 1, (uint64_t) value, width);
+        *buffer += 1 + width;
     }
-    *buffer += byte_size;
 }
 
-void packstream_write_text(char **buffer, size_t size, const char *value)
+void packstream_write_float(char **buffer, double value)
 {
-    size_t byte_size;
-    if (size < 0x10) {
-        char data[] = {(char) (0x80 | size)};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
-        memcpy(*buffer + byte_size, value, size);
-        byte_size += size;
-    } else if (size < 0x100) {
-        char data[] = {(char) 0xD0, (char) size};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
-        memcpy(*buffer + byte_size, value, size);
-        byte_size += size;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    (*buffer)[0] = (char) 0xC1;
+    packstream_store(*buffer + 1, bits, 8);
+    *buffer += 9;
+}
+
+// Tiny sizes are packed into the marker (unless tiny_marker is zero); otherwise
+// the smallest of the 8, 16 and 32-bit forms following marker_8 is chosen
+bool packstream_write_sized_header(char **buffer, size_t size, char tiny_marker, char marker_8)
+{
+    if (size > PACKSTREAM_MAX_SIZE) {
+        return false;
+    }
+    if (tiny_marker != 0 && size < 0x10) {
+        (*buffer)[0] = (char) (tiny_marker | size);
+        *buffer += 1;
     } else {
-        byte_size = 0;
+        int width_index = packstream_unsigned_width_index(size);
+        size_t width = (size_t) 1 << width_index;
+        (*buffer)[0] = (char) (marker_8 + width_index);
+        packstream_store(*buffer + 1, size, width);
+        *buffer += 1 + width;
     }
-    *buffer += byte_size;
+    return true;
 }
 
-void packstream_write_list_header(char **buffer, size_t size)
+bool packstream_write_text_header(char **buffer, size_t size)
 {
-    size_t byte_size;
-    if (size < 0x10) {
-        char data[] = {(char) (0x90 | size)};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
-    } else if (size < 0x100) {
-        char data[] = {(char) 0xD4, (char) size};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
-    } else {
-        byte_size = 0;
+    return packstream_write_sized_header(buffer, size, (char) 0x80, (char) 0xD0);
+}
+
+bool packstream_write_text(char **buffer, size_t size, const char *value)
+{
+    if (!packstream_write_text_header(buffer, size)) {
+        return false;
     }
-    *buffer += byte_size;
+    memcpy(*buffer, value, size);
+    *buffer += size;
+    return true;
 }
 
-void packstream_write_map_header(char **buffer, size_t size)
+bool packstream_write_bytes_header(char **buffer, size_t size)
 {
-    size_t byte_size;
-    if (size < 0x10) {
-        char data[] = {(char) (0xA0 | size)};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
-    } else if (size < 0x100) {
-        char data[] = {(char) 0xD8, (char) size};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
-    } else {
-        byte_size = 0;
+    return packstream_write_sized_header(buffer, size, 0, (char) 0xCC);
+}
+
+bool packstream_write_bytes(char **buffer, size_t size, const char *value)
+{
+    if (!packstream_write_bytes_header(buffer, size)) {
+        return false;
     }
-    *buffer += byte_size;
+    memcpy(*buffer, value, size);
+    *buffer += size;
+    return true;
+}
+
+bool packstream_write_list_header(char **buffer, size_t size)
+{
+    return packstream_write_sized_header(buffer, size, (char) 0x90, (char) 0xD4);
+}
+
+bool packstream_write_map_header(char **buffer, size_t size)
+{
+    return packstream_write_sized_header(buffer, size, (char) 0xA0, (char) 0xD8);
 }
 
-void packstream_write_map(char **buffer, size_t size, const PackStream_Pair *entries)
+bool packstream_write_map(char **buffer, size_t size, const PackStream_Pair *entries)
 {
-    packstream_write_map_header(buffer, size);
-    for (int i = 0; i < size; i++) {
+    if (!packstream_write_map_header(buffer, size)) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
         PackStream_Pair entry = entries[i];
-        packstream_write_value(buffer, &(entry.name));
-        packstream_write_value(buffer, &(entry.value));
+        if (!packstream_write_value(buffer, &(entry.name)) or !packstream_write_value(buffer, &(entry.value))) {
+            return false;
+        }
     }
+    return true;
 }
 
 void packstream_write_struct_header(char **buffer, size_t size, char signature)
 {
-    size_t byte_size;
     if (size < 0x10) {
-        char data[] = {(char) (0xB0 | size), signature};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
+        (*buffer)[0] = (char) (0xB0 | size);
+        (*buffer)[1] = signature;
+        *buffer += 2;
     } else if (size < 0x100) {
-        char data[] = {(char) 0xDC, (char) size, signature};
-        byte_size = sizeof data;
-        memcpy(*buffer, data, byte_size);
+        (*buffer)[0] = (char) 0xDC;
+        (*buffer)[1] = (char) size;
+        (*buffer)[2] = signature;
+        *buffer += 3;
     } else {
-        byte_size = 0;
+        (*buffer)[0] = (char) 0xDD;
+        packstream_store(*buffer + 1, size, 2);
+        (*buffer)[3] = signature;
+        *buffer += 4;
     }
-    *buffer += byte_size;
 }
 
-void packstream_write_value(char **buffer, PackStream_Value *value)
+bool packstream_write_value(char **buffer, PackStream_Value *value)
 {
     switch (value->type) {
+        case PACKSTREAM_NULL:
+            packstream_write_null(buffer);
+            return true;
+        case PACKSTREAM_BOOLEAN:
+            packstream_write_boolean(buffer, value->value != NULL);
+            return true;
         case PACKSTREAM_INTEGER:
             packstream_write_integer(buffer, (int64_t) (value->value));
-            break;
+            return true;
+        case PACKSTREAM_FLOAT: {
+            double float_value;
+            memcpy(&float_value, &value->value, sizeof float_value);
+            packstream_write_float(buffer, float_value);
+            return true;
+        }
+        case PACKSTREAM_BYTES:
+            return packstream_write_bytes(buffer, value->size, (char *) (value->value));
         case PACKSTREAM_TEXT:
-            packstream_write_text(buffer, value->size, (char *) (value->value));
-            break;
+            return packstream_write_text(buffer, value->size, (char *) (value->value));
         default:
             cerr << "This shouldn't happen: " << value->type << endl;
+            return false;
     }
 }
@@ -20,6 +20,8 @@
 #ifndef NEO4J_C_DRIVER_PACKSTREAM_H
 #define NEO4J_C_DRIVER_PACKSTREAM_H
 
+#include "arena.h"
+
 enum PackStream_Type {
     PACKSTREAM_RESERVED = -1,
     PACKSTREAM_NULL = 0,
@@ -34,6 +36,8 @@ enum PackStream_Type {
     PACKSTREAM_END_OF_STREAM = 9,
 };
 
+// Null, boolean, integer and float values (the latter as its bit pattern) are held
+// directly in `value`; for text and bytes it points at `size` bytes of data
 struct PackStream_Value {
     PackStream_Type type;
     size_t size;
@@ -45,13 +49,27 @@ struct PackStream_Pair {
     PackStream_Value value;
 };
 
+// What a marker byte says about the value it starts
+struct PackStream_Marker {
+    signed char type;               // PackStream_Type
+    unsigned char size_bytes;       // big-endian bytes after the marker holding the size (or, for scalars, the value)
+    signed char tiny_size;          // size packed into the marker itself, or -1 for a streamed list or map
+};
+
+extern const PackStream_Marker PACKSTREAM_MARKERS[256];
+
+static const size_t PACKSTREAM_MAX_SIZE = 0xFFFFFFFF;  // the 32-bit size form is the widest
+
 static const char NEO4J_IDENTITY = 'I';
 static const char NEO4J_NODE = 'N';
 static const char NEO4J_RELATIONSHIP = 'R';
 static const char NEO4J_UNBOUND_RELATIONSHIP = 'r';
-static const char NEO4J_PATH = 'I';
+static const char NEO4J_PATH = 'P';
 
-PackStream_Type packstream_next_type(const char *buffer);
+inline PackStream_Type packstream_next_type(const char *buffer)
+{
+    return (PackStream_Type) PACKSTREAM_MARKERS[(unsigned char) buffer[0]].type;
+}
 
 bool packstream_read_null(char **buffer);
 
@@ -61,7 +79,16 @@ bool packstream_read_integer(char **buffer, int64_t *value);
 
 bool packstream_read_float(char **buffer, double *value);
 
-bool packstream_read_text(char **buffer, int32_t *size, char **value);
+bool packstream_read_bytes_view(char **buffer, int32_t *size, const char **value);
+
+bool packstream_read_text_header(char **buffer, int32_t *size);
+
+// Borrowed view: *value points into the buffer being read and is not copied or terminated
+bool packstream_read_text_view(char **buffer, int32_t *size, const char **value);
+
+// Owned copy: *value is a null-terminated string allocated from the arena, or
+// allocated with new[] (for the caller to delete[]) if no arena is given
+bool packstream_read_text(char **buffer, int32_t *size, char **value, Arena *arena);
 
 bool packstream_read_list_header(char **buffer, int32_t *size);
 
@@ -69,6 +96,9 @@ bool packstream_read_map_header(char **buffer, int32_t *size);
 
 bool packstream_read_structure_header(char **buffer, int32_t *size, char *signature);
 
+// Move past the next value, including everything nested inside it, without decoding it
+bool packstream_skip(char **buffer);
+
 
 void packstream_write_null(char **buffer);
 
@@ -78,17 +108,24 @@ void packstream_write_integer(char **buffer, int64_t value);
 
 void packstream_write_float(char **buffer, double value);
 
-void packstream_write_text(char **buffer, size_t size, const char *value);
+// Sized values fail, writing nothing, if the size exceeds PACKSTREAM_MAX_SIZE
+bool packstream_write_bytes_header(char **buffer, size_t size);
+
+bool packstream_write_bytes(char **buffer, size_t size, const char *value);
+
+bool packstream_write_text_header(char **buffer, size_t size);
+
+bool packstream_write_text(char **buffer, size_t size, const char *value);
 
-void packstream_write_list_header(char **buffer, size_t size);
+bool packstream_write_list_header(char **buffer, size_t size);
 
-void packstream_write_map_header(char **buffer, size_t size);
+bool packstream_write_map_header(char **buffer, size_t size);
 
-void packstream_write_map(char **buffer, size_t size, const PackStream_Pair *entries);
+bool packstream_write_map(char **buffer, size_t size, const PackStream_Pair *entries);
 
 void packstream_write_struct_header(char **buffer, size_t size, char signature);
 
-void packstream_write_value(char **buffer, PackStream_Value *value);
+bool packstream_write_value(char **buffer, PackStream_Value *value);
 
 
 #endif // NEO4J_C_DRIVER_PACKSTREAM_H
@@ -0,0 +1,516 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks for the PackStream encode and decode kernels over synthetic corpora.
+// Nothing here touches the network, so results reflect the codec alone.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+
+#include "packstream.h"
+
+using namespace std;
+using namespace chrono;
+
+static const double MIN_PHASE_SECONDS = 0.2;
+static const int MIN_PHASE_REPEATS = 3;
+static const int DEEP_NESTING_DEPTH = 32;
+static const int WIDE_MAP_SIZE = 64;
+
+typedef char *(*Corpus_Encoder)(char *buffer);
+
+struct Corpus
+{
+    const char *name;
+    size_t count;                   // top-level values
+    size_t capacity;                // upper bound on encoded size
+    Corpus_Encoder encode;
+};
+
+static uint64_t random_state = 0x9E3779B97F4A7C15;
+
+// xorshift64*, so that every run encodes the same corpora
+uint64_t next_random()
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1D;
+}
+
+// Prepared inputs, shared by the encoders below
+
+static const size_t SCALAR_COUNT = 1 << 20;
+static const size_t SHORT_STRING_COUNT = 1 << 18;
+static const size_t LONG_STRING_COUNT = 1 << 12;
+static const size_t BYTES_COUNT = 1 << 16;
+static const size_t MAP_COUNT = 1 << 12;
+static const size_t NESTED_COUNT = 1 << 14;
+static const size_t GRAPH_COUNT = 1 << 14;
+
+static int64_t *small_ints;
+static int64_t *ids;
+static double *floats;
+static char *text;                  // source of string and byte contents
+static size_t text_size;
+static size_t *short_string_offsets;
+static size_t *short_string_sizes;
+static size_t *long_string_offsets;
+static size_t *long_string_sizes;
+static size_t *bytes_offsets;
+static size_t *bytes_sizes;
+static PackStream_Pair *map_entries;
+static char map_keys[WIDE_MAP_SIZE][16];
+static const char *LABELS[] = {"Person", "Movie", "Genre", "Company"};
+static const char *TYPES[] = {"ACTED_IN", "DIRECTED", "KNOWS"};
+
+void prepare_corpora()
+{
+    small_ints = new int64_t[SCALAR_COUNT];
+    ids = new int64_t[SCALAR_COUNT];
+    floats = new double[SCALAR_COUNT];
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        // Mostly tiny integers, with a tail needing 8 and 16-bit forms
+        small_ints[i] = (int64_t) (next_random() % 400) - 144;
+        // Identifiers of every width, as a store grows
+        ids[i] = (int64_t) (next_random() >> (next_random() % 64));
+        floats[i] = (double) (int64_t) next_random() / 1e9;
+    }
+
+    text_size = 1 << 20;
+    text = new char[text_size];
+    for (size_t i = 0; i < text_size; i++) {
+        text[i] = (char) ('a' + next_random() % 26);
+    }
+
+    short_string_offsets = new size_t[SHORT_STRING_COUNT];
+    short_string_sizes = new size_t[SHORT_STRING_COUNT];
+    for (size_t i = 0; i < SHORT_STRING_COUNT; i++) {
+        short_string_sizes[i] = 4 + next_random() % 21;
+        short_string_offsets[i] = next_random() % (text_size - short_string_sizes[i]);
+    }
+    long_string_offsets = new size_t[LONG_STRING_COUNT];
+    long_string_sizes = new size_t[LONG_STRING_COUNT];
+    for (size_t i = 0; i < LONG_STRING_COUNT; i++) {
+        long_string_sizes[i] = 1024 + next_random() % 15360;
+        long_string_offsets[i] = next_random() % (text_size - long_string_sizes[i]);
+    }
+    bytes_offsets = new size_t[BYTES_COUNT];
+    bytes_sizes = new size_t[BYTES_COUNT];
+    for (size_t i = 0; i < BYTES_COUNT; i++) {
+        bytes_sizes[i] = 16 + next_random() % 497;
+        bytes_offsets[i] = next_random() % (text_size - bytes_sizes[i]);
+    }
+
+    // Property maps mixing every scalar type
+    map_entries = new PackStream_Pair[MAP_COUNT * WIDE_MAP_SIZE];
+    for (int k = 0; k < WIDE_MAP_SIZE; k++) {
+        snprintf(map_keys[k], sizeof map_keys[k], "property_%d", k);
+    }
+    for (size_t i = 0; i < MAP_COUNT * WIDE_MAP_SIZE; i++) {
+        PackStream_Pair *entry = &map_entries[i];
+        const char *key = map_keys[i % WIDE_MAP_SIZE];
+        entry->name.type = PACKSTREAM_TEXT;
+        entry->name.size = strlen(key);
+        entry->name.value = (void *) key;
+        entry->value.size = 0;
+        switch (i % 5) {
+            case 0:
+                entry->value.type = PACKSTREAM_INTEGER;
+                entry->value.value = (void *) ids[i % SCALAR_COUNT];
+                break;
+            case 1:
+                entry->value.type = PACKSTREAM_FLOAT;
+                memcpy(&entry->value.value, &floats[i % SCALAR_COUNT], sizeof(double));
+                break;
+            case 2:
+                entry->value.type = PACKSTREAM_TEXT;
+                entry->value.size = short_string_sizes[i % SHORT_STRING_COUNT];
+                entry->value.value = text + short_string_offsets[i % SHORT_STRING_COUNT];
+                break;
+            case 3:
+                entry->value.type = PACKSTREAM_BOOLEAN;
+                entry->value.value = (void *) (i & 8);
+                break;
+            default:
+                entry->value.type = PACKSTREAM_NULL;
+                entry->value.value = NULL;
+        }
+    }
+}
+
+// Encoders
+
+char *encode_small_ints(char *buffer)
+{
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        packstream_write_integer(&buffer, small_ints[i]);
+    }
+    return buffer;
+}
+
+char *encode_ids(char *buffer)
+{
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        packstream_write_integer(&buffer, ids[i]);
+    }
+    return buffer;
+}
+
+char *encode_floats(char *buffer)
+{
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        packstream_write_float(&buffer, floats[i]);
+    }
+    return buffer;
+}
+
+char *encode_flags(char *buffer)
+{
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        uint64_t bits = (uint64_t) small_ints[i];
+        if ((bits & 3) == 0) {
+            packstream_write_null(&buffer);
+        }
+        else {
+            packstream_write_boolean(&buffer, (bits & 1) != 0);
+        }
+    }
+    return buffer;
+}
+
+char *encode_short_strings(char *buffer)
+{
+    for (size_t i = 0; i < SHORT_STRING_COUNT; i++) {
+        packstream_write_text(&buffer, short_string_sizes[i], text + short_string_offsets[i]);
+    }
+    return buffer;
+}
+
+char *encode_long_strings(char *buffer)
+{
+    for (size_t i = 0; i < LONG_STRING_COUNT; i++) {
+        // As bolt_write_text does, so that the body could be sent in place
+        packstream_write_text_header(&buffer, long_string_sizes[i]);
+        memcpy(buffer, text + long_string_offsets[i], long_string_sizes[i]);
+        buffer += long_string_sizes[i];
+    }
+    return buffer;
+}
+
+char *encode_bytes(char *buffer)
+{
+    for (size_t i = 0; i < BYTES_COUNT; i++) {
+        packstream_write_bytes(&buffer, bytes_sizes[i], text + bytes_offsets[i]);
+    }
+    return buffer;
+}
+
+char *encode_wide_maps(char *buffer)
+{
+    for (size_t i = 0; i < MAP_COUNT; i++) {
+        packstream_write_map(&buffer, WIDE_MAP_SIZE, &map_entries[i * WIDE_MAP_SIZE]);
+    }
+    return buffer;
+}
+
+char *encode_deep_nesting(char *buffer)
+{
+    for (size_t i = 0; i < NESTED_COUNT; i++) {
+        // [n, "level", [n, "level", [... {"leaf": n}]]]
+        for (int depth = 0; depth < DEEP_NESTING_DEPTH; depth++) {
+            packstream_write_list_header(&buffer, 3);
+            packstream_write_integer(&buffer, small_ints[(i + depth) % SCALAR_COUNT]);
+            packstream_write_text(&buffer, 5, "level");
+        }
+        packstream_write_map_header(&buffer, 1);
+        packstream_write_text(&buffer, 4, "leaf");
+        packstream_write_integer(&buffer, ids[i % SCALAR_COUNT]);
+    }
+    return buffer;
+}
+
+void encode_properties(char **buffer, size_t first, size_t count)
+{
+    packstream_write_map(buffer, count, &map_entries[(first % MAP_COUNT) * WIDE_MAP_SIZE]);
+}
+
+void encode_node(char **buffer, size_t i)
+{
+    packstream_write_struct_header(buffer, 3, NEO4J_NODE);
+    packstream_write_integer(buffer, ids[i % SCALAR_COUNT]);
+    packstream_write_list_header(buffer, 1 + i % 2);
+    for (size_t j = 0; j < 1 + i % 2; j++) {
+        const char *label = LABELS[(i + j) % 4];
+        packstream_write_text(buffer, strlen(label), label);
+    }
+    encode_properties(buffer, i, 4);
+}
+
+char *encode_graph(char *buffer)
+{
+    for (size_t i = 0; i < GRAPH_COUNT; i++) {
+        // Records of (node, relationship, node), with every eighth a path instead
+        const char *type = TYPES[i % 3];
+        if (i % 8 == 7) {
+            packstream_write_struct_header(&buffer, 3, NEO4J_PATH);
+            packstream_write_list_header(&buffer, 3);
+            for (size_t j = 0; j < 3; j++) {
+                encode_node(&buffer, i + j);
+            }
+            packstream_write_list_header(&buffer, 2);
+            for (size_t j = 0; j < 2; j++) {
+                packstream_write_struct_header(&buffer, 3, NEO4J_UNBOUND_RELATIONSHIP);
+                packstream_write_integer(&buffer, ids[(i + j) % SCALAR_COUNT]);
+                packstream_write_text(&buffer, strlen(type), type);
+                encode_properties(&buffer, i + j, 2);
+            }
+            packstream_write_list_header(&buffer, 4);
+            packstream_write_integer(&buffer, 1);
+            packstream_write_integer(&buffer, 1);
+            packstream_write_integer(&buffer, -2);
+            packstream_write_integer(&buffer, 2);
+            continue;
+        }
+        packstream_write_list_header(&buffer, 3);
+        encode_node(&buffer, i);
+        packstream_write_struct_header(&buffer, 5, NEO4J_RELATIONSHIP);
+        packstream_write_integer(&buffer, ids[(i + 2) % SCALAR_COUNT]);
+        packstream_write_integer(&buffer, ids[i % SCALAR_COUNT]);
+        packstream_write_integer(&buffer, ids[(i + 1) % SCALAR_COUNT]);
+        packstream_write_text(&buffer, strlen(type), type);
+        encode_properties(&buffer, i, 2);
+        encode_node(&buffer, i + 1);
+    }
+    return buffer;
+}
+
+// Decoders: a full walk through every read function, a walk that copies text out, and a skip
+
+uint64_t decode_value(char **reader, Arena *arena)
+{
+    uint64_t checksum = 0;
+    switch (packstream_next_type(*reader)) {
+        case PACKSTREAM_NULL:
+            if (!packstream_read_null(reader)) {
+                return 0;
+            }
+            return 1;
+        case PACKSTREAM_BOOLEAN: {
+            bool value;
+            if (!packstream_read_boolean(reader, &value)) {
+                return 0;
+            }
+            return value ? 3 : 2;
+        }
+        case PACKSTREAM_INTEGER: {
+            int64_t value;
+            if (!packstream_read_integer(reader, &value)) {
+                return 0;
+            }
+            return (uint64_t) value;
+        }
+        case PACKSTREAM_FLOAT: {
+            double value;
+            if (!packstream_read_float(reader, &value)) {
+                return 0;
+            }
+            return (uint64_t) value;
+        }
+        case PACKSTREAM_BYTES: {
+            int32_t size;
+            const char *value;
+            if (!packstream_read_bytes_view(reader, &size, &value)) {
+                return 0;
+            }
+            return (uint64_t) size + (size > 0 ? value[0] : 0);
+        }
+        case PACKSTREAM_TEXT: {
+            int32_t size;
+            if (arena != NULL) {
+                char *value;
+                if (!packstream_read_text(reader, &size, &value, arena)) {
+                    return 0;
+                }
+                return (uint64_t) size + value[0];
+            }
+            const char *value;
+            if (!packstream_read_text_view(reader, &size, &value)) {
+                return 0;
+            }
+            return (uint64_t) size + (size > 0 ? value[0] : 0);
+        }
+        case PACKSTREAM_LIST: {
+            int32_t size;
+            if (!packstream_read_list_header(reader, &size)) {
+                return 0;
+            }
+            for (int32_t i = 0; i < size; i++) {
+                checksum += decode_value(reader, arena);
+            }
+            return checksum + (uint64_t) size;
+        }
+        case PACKSTREAM_MAP: {
+            int32_t size;
+            if (!packstream_read_map_header(reader, &size)) {
+                return 0;
+            }
+            for (int32_t i = 0; i < 2 * size; i++) {
+                checksum += decode_value(reader, arena);
+            }
+            return checksum + (uint64_t) size;
+        }
+        case PACKSTREAM_STRUCTURE: {
+            int32_t size;
+            char signature;
+            if (!packstream_read_structure_header(reader, &size, &signature)) {
+                return 0;
+            }
+            for (int32_t i = 0; i < size; i++) {
+                checksum += decode_value(reader, arena);
+            }
+            return checksum + (uint64_t) signature;
+        }
+        default:
+            return 0;
+    }
+}
+
+uint64_t decode_corpus(char *buffer, size_t count, Arena *arena)
+{
+    uint64_t checksum = 0;
+    char *reader = buffer;
+    for (size_t i = 0; i < count; i++) {
+        checksum += decode_value(&reader, arena);
+        if (arena != NULL) {
+            arena_reset(arena);
+        }
+    }
+    return checksum;
+}
+
+uint64_t skip_corpus(char *buffer, size_t count)
+{
+    char *reader = buffer;
+    for (size_t i = 0; i < count; i++) {
+        if (!packstream_skip(&reader)) {
+            return 0;
+        }
+    }
+    return (uint64_t) (reader - buffer);
+}
+
+// Timing
+
+enum Bench_Phase
+{
+    PHASE_ENCODE,
+    PHASE_DECODE,
+    PHASE_COPY,
+    PHASE_SKIP,
+    PHASE_COUNT
+};
+
+static volatile uint64_t sink;
+
+// Best time of repeated runs, in seconds
+double time_phase(Corpus *corpus, Bench_Phase phase, char *buffer, Arena *arena)
+{
+    double best = 0.0;
+    double total = 0.0;
+    int repeats = 0;
+    while (repeats < MIN_PHASE_REPEATS or total < MIN_PHASE_SECONDS) {
+        time_point<high_resolution_clock> start = high_resolution_clock::now();
+        switch (phase) {
+            case PHASE_ENCODE:
+                sink = (uint64_t) (corpus->encode(buffer) - buffer);
+                break;
+            case PHASE_DECODE:
+                sink = decode_corpus(buffer, corpus->count, NULL);
+                break;
+            case PHASE_COPY:
+                sink = decode_corpus(buffer, corpus->count, arena);
+                break;
+            default:
+                sink = skip_corpus(buffer, corpus->count);
+        }
+        double elapsed = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+        if (repeats == 0 or elapsed < best) {
+            best = elapsed;
+        }
+        total += elapsed;
+        repeats += 1;
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    Corpus corpora[] = {
+        {"small_ints", SCALAR_COUNT, SCALAR_COUNT * 3, encode_small_ints},
+        {"ids", SCALAR_COUNT, SCALAR_COUNT * 9, encode_ids},
+        {"floats", SCALAR_COUNT, SCALAR_COUNT * 9, encode_floats},
+        {"flags", SCALAR_COUNT, SCALAR_COUNT, encode_flags},
+        {"short_strings", SHORT_STRING_COUNT, SHORT_STRING_COUNT * 26, encode_short_strings},
+        {"long_strings", LONG_STRING_COUNT, LONG_STRING_COUNT * (16384 + 5), encode_long_strings},
+        {"bytes", BYTES_COUNT, BYTES_COUNT * (512 + 5), encode_bytes},
+        {"wide_maps", MAP_COUNT, MAP_COUNT * (3 + WIDE_MAP_SIZE * (13 + 26)), encode_wide_maps},
+        {"deep_nesting", NESTED_COUNT, NESTED_COUNT * (DEEP_NESTING_DEPTH * 16 + 16), encode_deep_nesting},
+        {"graph", GRAPH_COUNT, GRAPH_COUNT * 2048, encode_graph},
+    };
+    int corpus_count = sizeof corpora / sizeof corpora[0];
+    const char *phase_names[PHASE_COUNT] = {"encode", "decode", "copy", "skip"};
+
+    prepare_corpora();
+    Arena *arena = arena_create(ARENA_DEFAULT_BLOCK_SIZE);
+
+    printf("%-14s %8s %10s", "corpus", "values", "bytes");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        printf(" | %8s ns/value   MB/s", phase_names[phase]);
+    }
+    printf("\n");
+    for (int c = 0; c < corpus_count; c++) {
+        Corpus *corpus = &corpora[c];
+        // Corpora named on the command line are run alone
+        bool selected = argc < 2;
+        for (int arg = 1; arg < argc; arg++) {
+            selected = selected or strcmp(argv[arg], corpus->name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+
+        char *buffer = new char[corpus->capacity];
+        size_t size = (size_t) (corpus->encode(buffer) - buffer);
+        if (size > corpus->capacity) {
+            fprintf(stderr, "%s: encoding overflowed its buffer\n", corpus->name);
+            return 1;
+        }
+        printf("%-14s %8zu %10zu", corpus->name, corpus->count, size);
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            double seconds = time_phase(corpus, (Bench_Phase) phase, buffer, arena);
+            printf(" | %17.2f %6.0f", 1e9 * seconds / corpus->count, size / seconds / 1e6);
+        }
+        printf("\n");
+        fflush(stdout);
+        delete[] buffer;
+    }
+
+    arena_destroy(arena);
+    return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Encode→decode round trips over the boundaries of every PackStream size and integer width.
+// Each check writes one value, reads it back, and compares both the value and the encoded size.
+
+#include <cmath>
+#include <cstdio>
+#include <string.h>
+
+#include "packstream.h"
+
+static const size_t TEST_BUFFER_SIZE = 0x30000;
+
+static char *test_buffer;
+static int failures = 0;
+
+void check(bool passed, const char *what, long long detail)
+{
+    if (!passed) {
+        fprintf(stderr, "FAILED: %s (%lld)\n", what, detail);
+        failures += 1;
+    }
+}
+
+// The value must be read back, and skipped, as exactly the bytes that were written
+void check_extent(char *end, char *read_end, size_t encoded_size, const char *what, long long detail)
+{
+    check(read_end == end, what, detail);
+    check((size_t) (end - test_buffer) == encoded_size, what, detail);
+    char *skipped = test_buffer;
+    check(packstream_skip(&skipped) and skipped == end, what, detail);
+}
+
+void test_integer(int64_t value, size_t encoded_size)
+{
+    char *writer = test_buffer;
+    packstream_write_integer(&writer, value);
+    char *reader = test_buffer;
+    int64_t read;
+    check(packstream_next_type(test_buffer) == PACKSTREAM_INTEGER, "integer type", value);
+    check(packstream_read_integer(&reader, &read) and read == value, "integer value", value);
+    check_extent(writer, reader, encoded_size, "integer size", value);
+}
+
+void test_float(double value)
+{
+    char *writer = test_buffer;
+    packstream_write_float(&writer, value);
+    char *reader = test_buffer;
+    double read;
+    check(packstream_read_float(&reader, &read) and memcmp(&read, &value, sizeof value) == 0, "float value", 0);
+    check_extent(writer, reader, 9, "float size", 0);
+}
+
+void test_scalars()
+{
+    char *writer = test_buffer;
+    packstream_write_null(&writer);
+    packstream_write_boolean(&writer, true);
+    packstream_write_boolean(&writer, false);
+    char *reader = test_buffer;
+    bool first;
+    bool second;
+    check(packstream_read_null(&reader), "null", 0);
+    check(packstream_read_boolean(&reader, &first) and first, "true", 0);
+    check(packstream_read_boolean(&reader, &second) and !second, "false", 0);
+    check(reader == writer and writer - test_buffer == 3, "scalar sizes", writer - test_buffer);
+}
+
+size_t sized_header_size(size_t size, bool has_tiny_form)
+{
+    if (has_tiny_form and size < 0x10) {
+        return 1;
+    }
+    return size < 0x100 ? 2 : size < 0x10000 ? 3 : 5;
+}
+
+void test_text(size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        test_buffer[TEST_BUFFER_SIZE / 2 + i] = (char) ('a' + i % 26);
+    }
+    const char *text = test_buffer + TEST_BUFFER_SIZE / 2;
+    char *writer = test_buffer;
+    check(packstream_write_text(&writer, size, text), "text written", (long long) size);
+    char *reader = test_buffer;
+    int32_t read_size;
+    const char *read;
+    check(packstream_read_text_view(&reader, &read_size, &read) and (size_t) read_size == size and
+          memcmp(read, text, size) == 0, "text value", (long long) size);
+    check_extent(writer, reader, sized_header_size(size, true) + size, "text size", (long long) size);
+}
+
+void test_bytes(size_t size)
+{
+    const char *bytes = test_buffer + TEST_BUFFER_SIZE / 2;
+    char *writer = test_buffer;
+    check(packstream_write_bytes(&writer, size, bytes), "bytes written", (long long) size);
+    char *reader = test_buffer;
+    int32_t read_size;
+    const char *read;
+    check(packstream_read_bytes_view(&reader, &read_size, &read) and (size_t) read_size == size and
+          memcmp(read, bytes, size) == 0, "bytes value", (long long) size);
+    check_extent(writer, reader, sized_header_size(size, false) + size, "bytes size", (long long) size);
+}
+
+// Headers only; the entries that would follow are not needed to check the size
+void test_container_headers(size_t size)
+{
+    char *writer = test_buffer;
+    check(packstream_write_list_header(&writer, size), "list header written", (long long) size);
+    char *reader = test_buffer;
+    int32_t read_size;
+    check(packstream_read_list_header(&reader, &read_size) and (size_t) read_size == size, "list size",
+          (long long) size);
+    check(reader == writer and (size_t) (writer - test_buffer) == sized_header_size(size, true),
+          "list header size", (long long) size);
+
+    writer = test_buffer;
+    check(packstream_write_map_header(&writer, size), "map header written", (long long) size);
+    reader = test_buffer;
+    check(packstream_read_map_header(&reader, &read_size) and (size_t) read_size == size, "map size",
+          (long long) size);
+    check(reader == writer and (size_t) (writer - test_buffer) == sized_header_size(size, true),
+          "map header size", (long long) size);
+}
+
+void test_structure(size_t size)
+{
+    char *writer = test_buffer;
+    packstream_write_struct_header(&writer, size, NEO4J_NODE);
+    for (size_t i = 0; i < size; i++) {
+        packstream_write_integer(&writer, (int64_t) i);
+    }
+    char *reader = test_buffer;
+    int32_t read_size;
+    char signature;
+    check(packstream_read_structure_header(&reader, &read_size, &signature) and (size_t) read_size == size and
+          signature == NEO4J_NODE, "structure header", (long long) size);
+    char *skipped = test_buffer;
+    check(packstream_skip(&skipped) and skipped == writer, "structure skip", (long long) size);
+}
+
+// A map holding a list holding every kind of value, read back entry by entry
+void test_nested()
+{
+    PackStream_Pair entries[2];
+    entries[0].name.type = PACKSTREAM_TEXT;
+    entries[0].name.size = 4;
+    entries[0].name.value = (void *) "name";
+    entries[0].value.type = PACKSTREAM_TEXT;
+    entries[0].value.size = 5;
+    entries[0].value.value = (void *) "Alice";
+    entries[1].name.type = PACKSTREAM_TEXT;
+    entries[1].name.size = 3;
+    entries[1].name.value = (void *) "age";
+    entries[1].value.type = PACKSTREAM_INTEGER;
+    entries[1].value.size = 0;
+    entries[1].value.value = (void *) (int64_t) 33;
+
+    char *writer = test_buffer;
+    packstream_write_list_header(&writer, 3);
+    check(packstream_write_map(&writer, 2, entries), "map written", 0);
+    packstream_write_float(&writer, 1.5);
+    packstream_write_list_header(&writer, 0);
+
+    char *reader = test_buffer;
+    int32_t size;
+    int32_t text_size;
+    const char *text;
+    int64_t integer;
+    double number;
+    check(packstream_read_list_header(&reader, &size) and size == 3, "outer list", size);
+    check(packstream_read_map_header(&reader, &size) and size == 2, "inner map", size);
+    check(packstream_read_text_view(&reader, &text_size, &text) and text_size == 4 and
+          memcmp(text, "name", 4) == 0, "first key", text_size);
+    check(packstream_read_text_view(&reader, &text_size, &text) and text_size == 5 and
+          memcmp(text, "Alice", 5) == 0, "first value", text_size);
+    check(packstream_read_text_view(&reader, &text_size, &text) and text_size == 3 and
+          memcmp(text, "age", 3) == 0, "second key", text_size);
+    check(packstream_read_integer(&reader, &integer) and integer == 33, "second value", integer);
+    check(packstream_read_float(&reader, &number) and number == 1.5, "float in list", 0);
+    check(packstream_read_list_header(&reader, &size) and size == 0, "empty list", size);
+    char *skipped = test_buffer;
+    check(reader == writer and packstream_skip(&skipped) and skipped == writer, "nested extent",
+          writer - test_buffer);
+}
+
+// Sizes beyond the 32-bit form cannot be encoded, and nothing may be written for them
+void test_oversized()
+{
+    size_t size = PACKSTREAM_MAX_SIZE + 1;
+    char *writer = test_buffer;
+    check(!packstream_write_text_header(&writer, size), "oversized text rejected", 0);
+    check(!packstream_write_bytes_header(&writer, size), "oversized bytes rejected", 0);
+    check(!packstream_write_list_header(&writer, size), "oversized list rejected", 0);
+    check(!packstream_write_map_header(&writer, size), "oversized map rejected", 0);
+    check(writer == test_buffer, "nothing written for oversized values", writer - test_buffer);
+
+    check(packstream_write_bytes_header(&writer, PACKSTREAM_MAX_SIZE), "largest size accepted", 0);
+    check(writer - test_buffer == 5 and (unsigned char) test_buffer[0] == 0xCE, "largest size form",
+          writer - test_buffer);
+}
+
+int main()
+{
+    test_buffer = new char[TEST_BUFFER_SIZE];
+
+    test_scalars();
+
+    // The smallest encoding is chosen at each width boundary
+    const int64_t integers[][2] = {
+            {0, 1}, {-1, 1}, {127, 1}, {-16, 1},
+            {-17, 2}, {-128, 2},
+            {128, 3}, {-129, 3}, {32767, 3}, {-32768, 3},
+            {32768, 5}, {-32769, 5}, {2147483647, 5}, {-2147483647 - 1, 5},
+            {2147483648, 9}, {-2147483649, 9}, {INT64_MAX, 9}, {INT64_MIN, 9},
+    };
+    for (size_t i = 0; i < sizeof integers / sizeof integers[0]; i++) {
+        test_integer(integers[i][0], (size_t) integers[i][1]);
+    }
+
+    const double floats[] = {0.0, -0.0, 1.5, -2.25, 1e300, -1e-300, INFINITY, -INFINITY, NAN};
+    for (size_t i = 0; i < sizeof floats / sizeof floats[0]; i++) {
+        test_float(floats[i]);
+    }
+
+    const size_t sizes[] = {0, 1, 15, 16, 255, 256, 65535, 65536};
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        test_text(sizes[i]);
+        test_bytes(sizes[i]);
+        test_container_headers(sizes[i]);
+    }
+    test_container_headers(PACKSTREAM_MAX_SIZE / 2);
+
+    const size_t structure_sizes[] = {0, 3, 15, 16, 255, 256};
+    for (size_t i = 0; i < sizeof structure_sizes / sizeof structure_sizes[0]; i++) {
+        test_structure(structure_sizes[i]);
+    }
+
+    test_nested();
+    test_oversized();
+
+    delete[] test_buffer;
+    puts(failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
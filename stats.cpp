@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+thread_local Bolt_Stats_Block *bolt_stats_block = NULL;
+
+static pthread_mutex_t bolt_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Bolt_Stats_Block *bolt_stats_blocks = NULL;
+static uint64_t bolt_stats_retired[BOLT_STAT_COUNT];
+
+static const char *BOLT_STAT_NAMES[BOLT_STAT_COUNT] = {
+    "send_calls",
+    "recv_calls",
+    "send_bytes",
+    "recv_bytes",
+    "messages_sent",
+    "chunks_sent",
+    "messages_received",
+    "chunks_received",
+    "encode_nanos",
+    "decode_nanos",
+    "buffer_growths",
+    "allocations",
+};
+
+// Folds a thread's counts into the retired totals when the thread exits
+struct Bolt_Stats_Owner
+{
+    ~Bolt_Stats_Owner()
+    {
+        Bolt_Stats_Block *block = bolt_stats_block;
+        if (block == NULL) {
+            return;
+        }
+        pthread_mutex_lock(&bolt_stats_mutex);
+        for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+            bolt_stats_retired[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+        if (block->previous == NULL) {
+            bolt_stats_blocks = block->next;
+        }
+        else {
+            block->previous->next = block->next;
+        }
+        if (block->next != NULL) {
+            block->next->previous = block->previous;
+        }
+        pthread_mutex_unlock(&bolt_stats_mutex);
+        bolt_stats_block = NULL;
+        delete block;
+    }
+};
+
+static thread_local Bolt_Stats_Owner bolt_stats_owner;
+
+Bolt_Stats_Block *bolt_stats_register()
+{
+    Bolt_Stats_Block *block = new Bolt_Stats_Block;
+    for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+        block->values[i].store(0, std::memory_order_relaxed);
+    }
+    block->previous = NULL;
+    pthread_mutex_lock(&bolt_stats_mutex);
+    block->next = bolt_stats_blocks;
+    if (block->next != NULL) {
+        block->next->previous = block;
+    }
+    bolt_stats_blocks = block;
+    pthread_mutex_unlock(&bolt_stats_mutex);
+    // Touching the owner arranges for its destructor to run at thread exit
+    (void) &bolt_stats_owner;
+    bolt_stats_block = block;
+    return block;
+}
+
+uint64_t bolt_stat_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+void bolt_stats_snapshot(Bolt_Stats *stats)
+{
+    pthread_mutex_lock(&bolt_stats_mutex);
+    for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+        stats->values[i] = bolt_stats_retired[i];
+    }
+    for (Bolt_Stats_Block *block = bolt_stats_blocks; block != NULL; block = block->next) {
+        for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+            stats->values[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&bolt_stats_mutex);
+}
+
+void bolt_stats_thread(Bolt_Stats *stats)
+{
+    Bolt_Stats_Block *block = bolt_stats_block;
+    for (int i = 0; i < BOLT_STAT_COUNT; i++) {
+        stats->values[i] = block == NULL ? 0 : block->values[i].load(std::memory_order_relaxed);
+    }
+}
+
+const char *bolt_stat_name(Bolt_Stat stat)
+{
+    return stat >= 0 and stat < BOLT_STAT_COUNT ? BOLT_STAT_NAMES[stat] : NULL;
+}
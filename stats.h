@@ -0,0 +1,90 @@
+/*
+ * Copyright 2015, Nigel Small
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cstdint>
+
+#ifndef NEO4J_C_DRIVER_STATS_H
+#define NEO4J_C_DRIVER_STATS_H
+
+enum Bolt_Stat
+{
+    BOLT_STAT_SEND_CALLS,
+    BOLT_STAT_RECV_CALLS,
+    BOLT_STAT_SEND_BYTES,
+    BOLT_STAT_RECV_BYTES,
+    BOLT_STAT_MESSAGES_SENT,
+    BOLT_STAT_CHUNKS_SENT,
+    BOLT_STAT_MESSAGES_RECEIVED,
+    BOLT_STAT_CHUNKS_RECEIVED,
+    BOLT_STAT_ENCODE_NANOS,         // building request messages
+    BOLT_STAT_DECODE_NANOS,         // reassembling chunks and reading PackStream values
+    BOLT_STAT_BUFFER_GROWTHS,       // read, write and in-flight buffers reallocated to grow
+    BOLT_STAT_ALLOCATIONS,          // heap allocations made for decoded values
+    BOLT_STAT_COUNT
+};
+
+struct Bolt_Stats
+{
+    uint64_t values[BOLT_STAT_COUNT];
+};
+
+// Each thread counts into its own block, which only that thread writes. Blocks are linked
+// together so that a snapshot can be taken from any thread.
+struct Bolt_Stats_Block
+{
+    std::atomic<uint64_t> values[BOLT_STAT_COUNT];
+    Bolt_Stats_Block *previous;
+    Bolt_Stats_Block *next;
+};
+
+extern thread_local Bolt_Stats_Block *bolt_stats_block;
+
+Bolt_Stats_Block *bolt_stats_register();
+
+inline void bolt_stat_add(Bolt_Stat stat, uint64_t amount)
+{
+    Bolt_Stats_Block *block = bolt_stats_block;
+    if (block == NULL) {
+        block = bolt_stats_register();
+    }
+    // A single writer needs no read-modify-write instruction
+    std::atomic<uint64_t> *value = &block->values[stat];
+    value->store(value->load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+uint64_t bolt_stat_now();
+
+// Totals across every thread, including threads that have since exited
+void bolt_stats_snapshot(Bolt_Stats *stats);
+
+// Totals for the calling thread only
+void bolt_stats_thread(Bolt_Stats *stats);
+
+const char *bolt_stat_name(Bolt_Stat stat);
+
+// Counting is compiled in with -DSEABOLT_STATS; without it these expand to nothing
+#ifdef SEABOLT_STATS
+#define BOLT_STAT_ADD(stat, amount) bolt_stat_add(stat, amount)
+#define BOLT_STAT_START(name) uint64_t name = bolt_stat_now()
+#define BOLT_STAT_STOP(stat, name) bolt_stat_add(stat, bolt_stat_now() - name)
+#else
+#define BOLT_STAT_ADD(stat, amount) ((void) 0)
+#define BOLT_STAT_START(name) ((void) 0)
+#define BOLT_STAT_STOP(stat, name) ((void) 0)
+#endif
+
+#endif // NEO4J_C_DRIVER_STATS_H